@@ -0,0 +1,142 @@
+#ifndef _DEFAULT_SOURCE
+	#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "utf8.h"
+#include "task.h"
+
+/*
+ * Microbenchmarks
+ * $ make bench
+ */
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Width functions as they were before the two-stage table */
+static size_t ref_g2w(const codepoint_t cp) {
+	if (cp < 0x20) return 0;
+	if (cp < 0x7f) return 1;
+	if (cp_in(zero_width, zero_width_len-1, cp)) return 0;
+	if (cp_in(double_width, double_width_len-1, cp)) return 2;
+	return 1;
+}
+
+static size_t ref_width(const char* b) {
+	size_t g = 0;
+	size_t s;
+	while (*b && (s = utf8_g2nb(b)) != 0) {
+		g += ref_g2w(utf8_b2cp(b));
+		b += s;
+	}
+	return g;
+}
+
+static const char* const corpora[][2] = {
+	{ "ascii", "Makefile-2018-03-14_backup.tar.gz" },
+	{ "latin", "Zwölf große Boxkämpfer jagen Viktor quer.txt" },
+	{ "cjk", "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae"
+		"\xe3\x83\x95\xe3\x82\xa1\xe3\x82\xa4\xe3\x83\xab"
+		"\xe5\x90\x8d\xe5\x89\x8d.txt" },
+};
+
+static int run(struct task* const t, const enum task_type tt,
+		char* const src, char* const dst, const char* const name,
+		const bool uring) {
+	struct string_list S = { NULL, 0 }, R = { NULL, 0 };
+	list_push(&S, name, -1);
+	task_new(t, tt, 0, src, dst, &S, &R);
+	if (!uring) t->cm &= ~CM_URING;
+	t->ts = TS_RUNNING;
+	while (t->ts == TS_RUNNING) {
+		task_do(t, task_action_copyremove, TS_FINISHED);
+	}
+	return t->ts == TS_FINISHED ? 0 : t->err;
+}
+
+/*
+ * Copies a tree of small files with each engine
+ * $ TMPDIR=/mnt/disk ./benchme 1000000
+ */
+static void copy_bench(const size_t files) {
+	char tdir[PATH_BUF_SIZE/2]; // Leaves room in p for what's inside
+	char p[PATH_BUF_SIZE];
+	const char* const tmp = getenv("TMPDIR");
+	if (snprintf(tdir, sizeof(tdir), "%s/hund-bench-XXXXXX",
+			tmp ? tmp : "/tmp") >= (int)sizeof(tdir)) {
+		fprintf(stderr, "TMPDIR too long\n");
+		return;
+	}
+	char b[4096];
+	memset(b, 'x', sizeof(b));
+	if (!mkdtemp(tdir)) return;
+	snprintf(p, sizeof(p), "%s/src", tdir);
+	mkdir(p, 0755);
+	for (size_t f = 0; f < files; ++f) {
+		if (!(f % 1000)) {
+			snprintf(p, sizeof(p), "%s/src/%zu", tdir, f / 1000);
+			mkdir(p, 0755);
+		}
+		snprintf(p, sizeof(p), "%s/src/%zu/%zu", tdir, f / 1000, f);
+		const int fd = open(p, O_WRONLY | O_CREAT, 0644);
+		if (fd == -1 || write(fd, b, sizeof(b)) != sizeof(b)) {
+			perror(p);
+			return;
+		}
+		close(fd);
+	}
+	static const char* const engine[] = { "regular", "io_uring" };
+	struct task t;
+	task_init(&t);
+	for (int u = 0; u < 2; ++u) {
+		snprintf(p, sizeof(p), "%s/%s", tdir, engine[u]);
+		mkdir(p, 0755);
+		const double s = now();
+		const int e = run(&t, TASK_COPY, tdir, p, "src", u);
+		const double d = now() - s;
+		const bool used = t.cms & CM_URING;
+		const double data = t.dns / 1e9;
+		const unsigned long long calls = t.calls;
+		task_clean(&t);
+		run(&t, TASK_REMOVE, p, p, "src", false);
+		task_clean(&t);
+		rmdir(p);
+		if (e) {
+			printf("copy %-8s %s\n", engine[u], strerror(e));
+			continue;
+		}
+		printf("copy %-8s %zu x 4KiB files %7.2f s %9.0f files/s"
+			" (data %.2f s, %llu calls)%s\n",
+			engine[u], files, d, files / d, data, calls,
+			(u && !used ? " (io_uring unavailable)" : ""));
+	}
+	run(&t, TASK_REMOVE, tdir, tdir, "src", false);
+	task_end(&t);
+	rmdir(tdir);
+}
+
+int main(int argc, char* argv[]) {
+	const size_t N = 2000000;
+	volatile size_t sink = 0;
+	for (size_t c = 0; c < sizeof(corpora)/sizeof(corpora[0]); ++c) {
+		const char* const s = corpora[c][1];
+		double t = now();
+		for (size_t n = 0; n < N; ++n) sink += ref_width(s);
+		const double tr = now() - t;
+		t = now();
+		for (size_t n = 0; n < N; ++n) sink += utf8_width(s);
+		const double tn = now() - t;
+		printf("utf8_width %-6s ref %6.1f ns  new %6.1f ns  x%.2f\n",
+			corpora[c][0], tr*1e9/N, tn*1e9/N, tr/tn);
+	}
+	(void)(sink);
+	copy_bench(argc > 1 ? strtoul(argv[1], NULL, 10) : 20000);
+	return 0;
+}
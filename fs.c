@@ -18,6 +18,7 @@
  */
 
 #include "fs.h"
+#include "utf8.h"
 
 /* Similar to strlcpy;
  * Copies string pointed by src to dest.
@@ -69,21 +70,19 @@ int relative_chmod(const char* const file,
 }
 
 /*
- * Checks of two files are on the same filesystem.
- * If they are, moving files (and even whole directories)
- * can be done with just rename() function.
+ * Incremented every time file records are freed
+ * Pointers to file records from older generations may be reused
  */
-bool same_fs(const char* const a, const char* const b) {
-	struct stat sa, sb;
-	return !stat(a, &sa) && !stat(b, &sb) && (sa.st_dev == sb.st_dev);
-}
+unsigned long fs_generation = 0;
 
 /*
  * Cleans up list created by scan_dir()
  */
 void file_list_clean(struct file*** const fl, fnum_t* const nf) {
 	if (!*nf) return;
+	fs_generation += 1;
 	for (fnum_t i = 0; i < *nf; ++i) {
+		free((*fl)[i]->c);
 		free((*fl)[i]);
 	}
 	free(*fl);
@@ -150,9 +149,11 @@ int scan_dir(const char* const wd, struct file*** const fl,
 		if (de->d_name[0] == '.') {
 			*nhf += 1;
 		}
+		nfr->c = NULL;
 		nfr->selected = false;
 		nfr->nl = (unsigned char)nl;
 		memcpy(nfr->name, de->d_name, nl+1);
+		nfr->nc = utf8_classify(nfr->name, nl);
 
 		if (!(err = pushd(fpath, &fpathlen, nfr->name, nl))) {
 			if (lstat(fpath, &nfr->s)) {
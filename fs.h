@@ -102,15 +102,31 @@ char* get_home(void);
 
 int relative_chmod(const char* const, const mode_t, const mode_t);
 
-bool same_fs(const char* const, const char* const);
+struct file_cache; // See ui.h
 
 struct file {
 	struct stat s;
+	struct file_cache* c;
 	bool selected;
 	unsigned char nl;
+	unsigned char nc; // Name class; enum utf8_class
 	char name[];
 };
 
+/*
+ * Volume of a directory, counted like du(1) does
+ */
+struct dir_volume {
+	dev_t dev;
+	ino_t ino;
+	struct timespec ctim; // Of directory when it was measured
+	off_t size; // Apparent
+	blkcnt_t blocks; // Allocated; 512 B each, like st_blocks
+	int err; // First error met; volume is then at least that much
+};
+
+extern unsigned long fs_generation;
+
 void file_list_clean(struct file*** const, fnum_t* const);
 int scan_dir(const char* const, struct file*** const,
 		fnum_t* const, fnum_t* const);
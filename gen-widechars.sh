@@ -1,17 +1,74 @@
 #!/usr/bin/sh
 
-# This stript downloads and parses these files:
+# This stript parses these files:
 # http://www.unicode.org/Public/UCD/latest/ucd/EastAsianWidth.txt
 # http://www.unicode.org/Public/UCD/latest/ucd/UnicodeData.txt
-# in order to generate tables of zero-width, and double-width characters.
+# in order to generate tables of zero-width, and double-width characters
+# and a two-stage table of widths of all codepoints.
 
 # Files listed above belong to Unicode. You can find the license here:
 # http://www.unicode.org/copyright.html
 # or here:
 # http://www.unicode.org/terms_of_use.html
 
-# To generate new 'widechars.h':
+# To generate new 'widechars.h' (downloads files listed above):
 # $ ./gen-widechars.sh > widechars.h
+# From local copies of these files:
+# $ ./gen-widechars.sh EastAsianWidth.txt UnicodeData.txt > widechars.h
+# Only regenerate the two-stage table, reusing ranges from old 'widechars.h':
+# $ ./gen-widechars.sh -r widechars.h > widechars.h.new
+
+set -e
+
+UCD=http://www.unicode.org/Public/UCD/latest/ucd
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+
+if [ "$1" = "-r" ] && [ -n "$2" ]; then
+	sed -n '/double_width\[\]\[2\]/,/^};/p' "$2" | grep '^	{' > "$T/double"
+	sed -n '/zero_width\[\]\[2\]/,/^};/p' "$2" | grep '^	{' > "$T/zero"
+else
+	if [ -n "$1" ] && [ -n "$2" ]; then
+		cp "$1" "$T/EastAsianWidth.txt"
+		cp "$2" "$T/UnicodeData.txt"
+	else
+		curl -s "$UCD/EastAsianWidth.txt" > "$T/EastAsianWidth.txt"
+		curl -s "$UCD/UnicodeData.txt" > "$T/UnicodeData.txt"
+	fi
+	awk -F';' '/^[0-9A-Fa-f]/ {
+		r = $1
+		gsub(/[ \t]/, "", r)
+		c = $2
+		sub(/^[ \t]*/, "", c)
+		sub(/[ \t#].*$/, "", c)
+		if (c != "F" && c != "W") next
+		n = split(r, a, /\.\./)
+		printf "\t{0x%s, 0x%s},\n", a[1], (n > 1 ? a[2] : a[1])
+	}' "$T/EastAsianWidth.txt" > "$T/double"
+	awk -F';' '
+	function hex(s,    i, v) {
+		v = 0
+		for (i = 1; i <= length(s); ++i) {
+			v = v*16 + index("0123456789ABCDEF", toupper(substr(s, i, 1))) - 1
+		}
+		return v
+	}
+	$3 == "Cf" || $3 == "Mn" || $3 == "Me" \
+	|| substr($2, 1, 16) == "HANGUL JUNGSEONG" \
+	|| substr($2, 1, 16) == "HANGUL JONGSEONG" {
+		cp = hex($1)
+		if (n && cp == rb+1) {
+			rb = cp
+			next
+		}
+		if (n) printf "\t{0x%X, 0x%X},\n", ra, rb
+		ra = rb = cp
+		n = 1
+	}
+	END {
+		if (n) printf "\t{0x%X, 0x%X},\n", ra, rb
+	}' "$T/UnicodeData.txt" > "$T/zero"
+fi
 
 echo "/*"
 echo " * This file was generated by a script using these files:"
@@ -28,49 +85,95 @@ echo "#define WIDECHARS_H"
 echo
 echo "// A sorted list of ranges of Unicode codepoints of double-width characters"
 echo "static const unsigned int double_width[][2] = {"
-IFS=$'\n'
-for line in $(curl -s http://www.unicode.org/Public/UCD/latest/ucd/EastAsianWidth.txt)
-do
-	if [ "${line:0:1}" == "#" ]; then
-		continue
-	fi
-	range=$(echo $line | cut -d ';' -f 1)
-	a=$(echo $range | cut -d '.' -f 1)
-	b=$(echo $range | cut -d '.' -f 3)
-	category=$(echo $line | cut -d ';' -f 2 | cut -d ' ' -f 1)
-	if [ "$category" == "F" ] || [ "$category" == "W" ]; then
-		echo -e "\t{0x$a, 0x$b},"
-	fi
-done
+cat "$T/double"
 echo "};"
 echo "static const size_t double_width_len = sizeof(double_width)/sizeof(double_width[0]);"
 echo
 echo "// A sorted list of ranges of Unicode codepoints of zero-width characters"
 echo "static const unsigned int zero_width[][2] = {"
-ra=0
-rb=0
-IFS=$'\n'
-for line in $(curl -s http://www.unicode.org/Public/UCD/latest/ucd/UnicodeData.txt)
-do
-	cp=$(printf '%d' "0x$(echo $line | cut -d ';' -f 1)")
-	name=$(echo $line | cut -d ';' -f 2)
-	category=$(echo $line | cut -d ';' -f 3)
-	if [ "$category" == "Cf" ] \
-	|| [ "$category" == "Mn" ] \
-	|| [ "$category" == "Me" ] \
-	|| [ "${name:0:16}" == "HANGUL JUNGSEONG" ] \
-	|| [ "${name:0:16}" == "HANGUL JONGSEONG" ]; then
-		if (( cp == rb+1 )); then
-			rb=$cp
-			continue
-		else
-			printf "\t{0x%X, 0x%X},\n" $ra $rb
-			ra=$cp
-			rb=$cp
-		fi
-	fi
-done
+cat "$T/zero"
 echo "};"
 echo "static const size_t zero_width_len = sizeof(zero_width)/sizeof(zero_width[0]);"
+echo
+
+# Two-stage table: codepoints are split into blocks of 256.
+# Stage 1 maps block number to one of unique blocks in stage 2.
+# Stage 2 packs 4 widths (2 bits each) into a byte.
+# Widths follow the same rules as the ranges above:
+# controls are 0, zero-width wins over double-width.
+awk '
+function hex(s,    i, v) {
+	v = 0
+	for (i = 1; i <= length(s); ++i) {
+		v = v*16 + index("0123456789ABCDEF", toupper(substr(s, i, 1))) - 1
+	}
+	return v
+}
+function range(line, lo, hi,    a) {
+	gsub(/[^0-9A-Fa-fx,]/, "", line)
+	split(line, a, ",")
+	lo[0] = hex(substr(a[1], 3))
+	hi[0] = hex(substr(a[2], 3))
+}
+BEGIN { f = nd = nz = 0 }
+FNR == 1 { f += 1 }
+{
+	range($0, L, H)
+	if (f == 1) { dl[nd] = L[0]; dh[nd] = H[0]; nd += 1 }
+	else { zl[nz] = L[0]; zh[nz] = H[0]; nz += 1 }
+}
+END {
+	di = zi = 0
+	nb = 0
+	for (B = 0; B < 4352; ++B) {
+		key = ""
+		for (j = 0; j < 64; ++j) {
+			byte = 0
+			for (k = 0; k < 4; ++k) {
+				cp = B*256 + j*4 + k
+				while (di < nd && dh[di] < cp) di += 1
+				while (zi < nz && zh[zi] < cp) zi += 1
+				if (cp < 32) w = 0
+				else if (cp < 127) w = 1
+				else if (zi < nz && zl[zi] <= cp) w = 0
+				else if (di < nd && dl[di] <= cp) w = 2
+				else w = 1
+				byte += w * (k == 0 ? 1 : k == 1 ? 4 : k == 2 ? 16 : 64)
+			}
+			key = key sprintf("0x%02X,", byte)
+		}
+		if (!(key in id)) {
+			id[key] = nb
+			blk[nb] = key
+			nb += 1
+		}
+		s1[B] = id[key]
+	}
+	print "// Two-stage table of widths of all codepoints; see utf8_g2w()"
+	print "static const unsigned char width_stage1[0x110000 >> 8] = {"
+	for (B = 0; B < 4352; B += 16) {
+		line = "\t"
+		for (j = 0; j < 16; ++j) {
+			line = line sprintf("%d,%s", s1[B+j], (j < 15 ? " " : ""))
+		}
+		print line
+	}
+	print "};"
+	print "static const unsigned char width_stage2[][64] = {"
+	for (b = 0; b < nb; ++b) {
+		print "\t{"
+		n = split(blk[b], a, ",")
+		for (j = 0; j < 64; j += 8) {
+			line = "\t\t"
+			for (k = j; k < j+8; ++k) {
+				line = line a[k+1] "," (k < j+7 ? " " : "")
+			}
+			print line
+		}
+		print "\t},"
+	}
+	print "};"
+}' "$T/double" "$T/zero"
+
 echo
 echo "#endif"
@@ -0,0 +1,254 @@
+/*
+ *  Copyright (C) 2017-2018 by Michał Czarnecki <czarnecky@va.pl>
+ *
+ *  This file is part of the Hund.
+ *
+ *  The Hund is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Hund is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "loop.h"
+
+struct watch {
+	int fd;
+	short events;
+	loop_fd_cb cb;
+	void* data;
+};
+
+struct timer {
+	struct timespec at;
+	int ms; // period
+	loop_cb cb; // NULL = unused
+	void* data;
+};
+
+static int sp[2] = { -1, -1 }; // self-pipe; signal handler writes to sp[1]
+static struct watch W[LOOP_FDS];
+static int nw;
+static struct timer T[LOOP_TIMERS];
+static struct {
+	loop_cb cb;
+	void* data;
+} S[LOOP_SIGNALS];
+
+static void _handler(int sig) {
+	const int e = errno;
+	const unsigned char s = sig;
+	const ssize_t w = write(sp[1], &s, 1);
+	(void)(w);
+	errno = e;
+}
+
+static int _nonblock(const int fd) {
+	const int fl = fcntl(fd, F_GETFL);
+	if (fl == -1
+	|| fcntl(fd, F_SETFL, fl | O_NONBLOCK)
+	|| fcntl(fd, F_SETFD, FD_CLOEXEC)) {
+		return errno;
+	}
+	return 0;
+}
+
+/*
+ * Milliseconds from now until at; rounded up, never negative
+ */
+static int _ms(const struct timespec* const at,
+		const struct timespec* const now) {
+	const long long ns = (at->tv_sec - now->tv_sec) * 1000000000LL
+		+ (at->tv_nsec - now->tv_nsec);
+	if (ns <= 0) return 0;
+	return (ns + 999999) / 1000000;
+}
+
+static void _add_us(struct timespec* const t, const long long us) {
+	const long long ns = t->tv_nsec + (us % 1000000) * 1000;
+	t->tv_sec += us / 1000000 + ns / 1000000000;
+	t->tv_nsec = ns % 1000000000;
+}
+
+int loop_init(void) {
+	if (sp[0] != -1) return 0;
+	nw = 0;
+	memset(W, 0, sizeof(W));
+	memset(T, 0, sizeof(T));
+	memset(S, 0, sizeof(S));
+	if (pipe(sp)) return errno;
+	int err;
+	if ((err = _nonblock(sp[0])) || (err = _nonblock(sp[1]))) {
+		loop_end();
+		return err;
+	}
+	return 0;
+}
+
+void loop_end(void) {
+	for (int s = 1; s < LOOP_SIGNALS; ++s) {
+		if (S[s].cb) signal(s, SIG_DFL);
+		S[s].cb = NULL;
+	}
+	for (int t = 0; t < LOOP_TIMERS; ++t) {
+		T[t].cb = NULL;
+	}
+	nw = 0;
+	if (sp[0] != -1) {
+		close(sp[0]);
+		close(sp[1]);
+	}
+	sp[0] = sp[1] = -1;
+}
+
+/*
+ * Watches fd for events; cb == NULL or events == 0 stops watching
+ */
+int loop_fd(const int fd, const short events,
+		const loop_fd_cb cb, void* const data) {
+	int w = 0;
+	while (w < nw && W[w].fd != fd) w += 1;
+	if (!cb || !events) {
+		if (w < nw) {
+			W[w] = W[nw-1];
+			nw -= 1;
+		}
+		return 0;
+	}
+	if (w == nw) {
+		if (nw == LOOP_FDS) return ENOMEM;
+		nw += 1;
+	}
+	W[w].fd = fd;
+	W[w].events = events;
+	W[w].cb = cb;
+	W[w].data = data;
+	return 0;
+}
+
+/*
+ * Callback is called from loop_wait(), not from signal handler
+ * cb == NULL restores default action
+ */
+int loop_signal(const int sig, const loop_cb cb, void* const data) {
+	if (sig <= 0 || sig >= LOOP_SIGNALS) return EINVAL;
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(struct sigaction));
+	sa.sa_handler = (cb ? _handler : SIG_DFL);
+	S[sig].cb = cb;
+	S[sig].data = data;
+	if (sigaction(sig, &sa, NULL)) return errno;
+	return 0;
+}
+
+/*
+ * Calls cb every ms milliseconds
+ * Returns timer id or -1
+ */
+int loop_timer(const int ms, const loop_cb cb, void* const data) {
+	for (int t = 0; t < LOOP_TIMERS; ++t) {
+		if (T[t].cb) continue;
+		clock_gettime(CLOCK_MONOTONIC, &T[t].at);
+		_add_us(&T[t].at, ms*1000LL);
+		T[t].ms = ms;
+		T[t].cb = cb;
+		T[t].data = data;
+		return t;
+	}
+	return -1;
+}
+
+void loop_timer_stop(const int t) {
+	if (0 <= t && t < LOOP_TIMERS) T[t].cb = NULL;
+}
+
+static bool _signals(void) {
+	bool wake = false;
+	unsigned char s[16];
+	ssize_t r;
+	while ((r = read(sp[0], s, sizeof(s))) > 0) {
+		for (ssize_t k = 0; k < r; ++k) {
+			if (s[k] < LOOP_SIGNALS && S[s[k]].cb
+			&& S[s[k]].cb(s[k], S[s[k]].data)) {
+				wake = true;
+			}
+		}
+	}
+	return wake;
+}
+
+static bool _timers(const struct timespec* const now) {
+	bool wake = false;
+	for (int t = 0; t < LOOP_TIMERS; ++t) {
+		if (!T[t].cb || _ms(&T[t].at, now)) continue;
+		T[t].at = *now;
+		_add_us(&T[t].at, T[t].ms*1000LL);
+		if (T[t].cb(t, T[t].data)) wake = true;
+	}
+	return wake;
+}
+
+/*
+ * Waits until fd is readable, dispatching signals,
+ * timers and watched fds meanwhile
+ * fd == -1 only dispatches events
+ * timeout_us < 0 waits indefinitely, 0 only checks
+ * Returns 1 if fd is readable, 0 on timeout or when
+ * a callback woke the caller up, -1 on error
+ */
+int loop_wait(const int fd, const int timeout_us) {
+	struct pollfd P[2+LOOP_FDS];
+	struct timespec end, now;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (timeout_us > 0) _add_us(&end, timeout_us);
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int to = (timeout_us < 0 ? -1 : _ms(&end, &now));
+		for (int t = 0; t < LOOP_TIMERS; ++t) {
+			if (!T[t].cb) continue;
+			const int tt = _ms(&T[t].at, &now);
+			if (to < 0 || tt < to) to = tt;
+		}
+		int n = 0;
+		P[n].fd = sp[0];
+		P[n].events = POLLIN;
+		P[n++].revents = 0;
+		const int fi = (fd >= 0 ? n++ : -1);
+		if (fi != -1) {
+			P[fi].fd = fd;
+			P[fi].events = POLLIN;
+			P[fi].revents = 0;
+		}
+		const int wi = n;
+		for (int w = 0; w < nw; ++w, ++n) {
+			P[n].fd = W[w].fd;
+			P[n].events = W[w].events;
+			P[n].revents = 0;
+		}
+		const int r = poll(P, n, to);
+		if (r == -1 && errno != EINTR) return -1;
+		bool wake = false;
+		if (r == -1 || P[0].revents) wake |= _signals();
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		wake |= _timers(&now);
+		for (int p = wi; r > 0 && p < n; ++p) {
+			if (!P[p].revents) continue;
+			/* Callbacks may (un)register fds */
+			int w = 0;
+			while (w < nw && W[w].fd != P[p].fd) w += 1;
+			if (w < nw && W[w].cb(P[p].fd, P[p].revents, W[w].data)) {
+				wake = true;
+			}
+		}
+		if (r > 0 && fi != -1 && P[fi].revents) return 1;
+		if (wake) return 0;
+		if (timeout_us >= 0 && !_ms(&end, &now)) return 0;
+	}
+}
@@ -0,0 +1,65 @@
+/*
+ *  Copyright (C) 2017-2018 by Michał Czarnecki <czarnecky@va.pl>
+ *
+ *  This file is part of the Hund.
+ *
+ *  The Hund is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Hund is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOOP_H
+#define LOOP_H
+
+#ifndef _DEFAULT_SOURCE
+	#define _DEFAULT_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Event loop
+ *
+ * Everything hund waits for goes through loop_wait():
+ * input, signals, timers and any registered file descriptor.
+ * Signals are delivered through a self-pipe, so their
+ * callbacks run in normal context, not in signal handler.
+ *
+ * Callbacks return true to wake up loop_wait() caller
+ * (for example to redraw or to check if hund should exit).
+ */
+
+#define LOOP_FDS 16
+#define LOOP_TIMERS 4
+#define LOOP_SIGNALS 32
+
+typedef bool (*loop_fd_cb)(int, short, void*);
+typedef bool (*loop_cb)(int, void*);
+
+int loop_init(void);
+void loop_end(void);
+
+int loop_fd(int, short, loop_fd_cb, void*);
+int loop_signal(int, loop_cb, void*);
+int loop_timer(int, loop_cb, void*);
+void loop_timer_stop(int);
+
+int loop_wait(int, int);
+
+#endif
@@ -65,8 +65,11 @@ char* xgetenv(char* q[]) {
 
 int pager_spawn(int* const fd, pid_t* const pid) {
 	int pipefd[2];
+	output_nonblock(false);
 	if (pipe(pipefd) || (*pid = fork()) == -1) {
-		return errno;
+		const int e = errno;
+		output_nonblock(true);
+		return e;
 	}
 	if (*pid == 0) {
 		close(pipefd[1]);
@@ -84,6 +87,7 @@ void pager_done(int fd, const pid_t pid) {
 	int status;
 	close(fd);
 	waitpid(pid, &status, 0);
+	output_nonblock(true);
 }
 
 struct mark_path {
@@ -202,6 +206,7 @@ static inline void list_marks(struct ui* const i, struct marks* const m) {
 		return;
 	}
 	pager_done(fd, p);
+	ui_invalidate(i);
 }
 
 static int open_file_with(char* const p, char* const f) {
@@ -219,6 +224,7 @@ static void open_help(struct ui* const i) {
 	}
 	help_to_fd(i, fd);
 	pager_done(fd, p);
+	ui_invalidate(i);
 }
 
 static int edit_list(struct string_list* const in,
@@ -337,7 +343,7 @@ inline static bool _solve_name_conflicts_if_any(struct ui* const i,
 	return true;
 }
 
-static void prepare_task(struct ui* const i, struct task* const t,
+static void prepare_task(struct ui* const i, struct task_queue* const q,
 		const enum task_type tt) {
 	static const struct select_option o[] = {
 		{ KUTF8("y"), "yes" },
@@ -345,6 +351,10 @@ static void prepare_task(struct ui* const i, struct task* const t,
 	};
 	struct string_list S = { NULL, 0 }; // Selected
 	struct string_list R = { NULL, 0 }; // Renamed
+	if (q->n == TASKS_MAX) {
+		failed(i, "task", "Too many tasks in queue");
+		return;
+	}
 	panel_selected_to_list(i->pv, &S);
 	if (!S.len) return;
 	if (tt & (TASK_MOVE | TASK_COPY)) {
@@ -359,7 +369,15 @@ static void prepare_task(struct ui* const i, struct task* const t,
 	&& !ui_ask(i, "Apply recursively?", o, 2)) {
 		tf |= TF_RECURSIVE_CHMOD;
 	}
+	if (i->nocache && (tt & (TASK_MOVE | TASK_COPY))) {
+		tf |= TF_NOCACHE;
+	}
+	if (i->journal && (tt & (TASK_MOVE | TASK_COPY))) {
+		tf |= TF_JOURNAL;
+	}
+	struct task* const t = task_queue_add(q);
 	task_new(t, tt, tf, i->pv->wd, i->sv->wd, &S, &R);
+	if (!i->uring) t->cm &= ~CM_URING;
 	if (tt == TASK_CHMOD) {
 		t->chp = i->plus;
 		t->chm = i->minus;
@@ -680,14 +698,114 @@ static void cmd_quick_chmod_plus_x(struct ui* const i) {
 	ui_rescan(i, i->pv, NULL);
 }
 
-static void interpreter(struct ui* const i, struct task* const t,
+/*
+ * Volume of directories is measured in background;
+ * what is finished is put into panels on timer ticks
+ */
+#define VOLUME_TICK_MS 100
+static struct volume_pool* volume;
+static int volume_timer = -1;
+static bool volume_due;
+static off_t volume_size;
+static blkcnt_t volume_blocks;
+static int volume_err;
+
+static bool _volume_tick(int t, void* data) {
+	(void)(t);
+	*(bool*)data = true;
+	return true;
+}
+
+static void volume_stop(void) {
+	volume_end(&volume);
+	loop_timer_stop(volume_timer);
+	volume_timer = -1;
+}
+
+static void cmd_volume(struct ui* const i) {
+	struct string_list S = { NULL, 0 }; // Selected
+	struct string_list D = { NULL, 0 }; // Directories of them
+	panel_selected_to_list(i->pv, &S);
+	for (fnum_t s = 0; s < S.len; ++s) {
+		const fnum_t f = file_on_list(i->pv, S.arr[s]->str);
+		if (f != (fnum_t)-1 && S_ISDIR(i->pv->file_list[f]->s.st_mode)) {
+			list_push(&D, S.arr[s]->str, S.arr[s]->len);
+		}
+	}
+	list_free(&S);
+	if (!D.len) {
+		failed(i, "volume", "No directory selected");
+		return;
+	}
+	volume_stop();
+	volume_size = volume_blocks = volume_err = 0;
+	int err;
+	if ((err = volume_start(&volume, i->pv->wd, &D))) {
+		failed(i, "volume", strerror(err));
+	}
+	else {
+		volume_timer = loop_timer(VOLUME_TICK_MS,
+				_volume_tick, &volume_due);
+		i->mt = MSG_INFO;
+		snprintf(i->msg, MSG_BUFFER_SIZE, "Measuring %u director%s...",
+				D.len, (D.len > 1 ? "ies" : "y"));
+		i->dirty |= DIRTY_BOTTOMBAR;
+	}
+	list_free(&D);
+}
+
+static void volume_update(struct ui* const i) {
+	if (!volume || !volume_due) return;
+	volume_due = false;
+	/* All that finished since last tick; panels sort once */
+	static struct dir_volume* v;
+	static fnum_t cap;
+	fnum_t n = 0, r;
+	do {
+		if (n == cap) {
+			struct dir_volume* const nv = realloc(v,
+				(cap ? 2*cap : 64) * sizeof(struct dir_volume));
+			if (!nv) break;
+			v = nv;
+			cap = (cap ? 2*cap : 64);
+		}
+		n += (r = volume_take(volume, v+n, cap-n));
+	} while (r);
+	for (fnum_t k = 0; k < n; ++k) {
+		volume_size += v[k].size;
+		volume_blocks += v[k].blocks;
+		if (!volume_err) volume_err = v[k].err;
+	}
+	if (n) {
+		panel_volumes(i->fvs[0], v, n);
+		panel_volumes(i->fvs[1], v, n);
+		i->dirty |= DIRTY_PANELS;
+	}
+	if (!volume_finished(volume)) return;
+	free(v);
+	v = NULL;
+	cap = 0;
+	volume_stop();
+	char ps[SIZE_BUF_SIZE], pb[SIZE_BUF_SIZE];
+	pretty_size(volume_size, ps);
+	pretty_size(volume_blocks*512, pb);
+	i->mt = (volume_err ? MSG_ERROR : MSG_INFO);
+	int l = snprintf(i->msg, MSG_BUFFER_SIZE,
+			"Volume: %s, %s allocated", ps, pb);
+	if (volume_err) {
+		snprintf(i->msg+l, MSG_BUFFER_SIZE-l, " (at least; %s)",
+				strerror(volume_err));
+	}
+	i->dirty |= DIRTY_BOTTOMBAR;
+}
+
+static void interpreter(struct ui* const i, struct task_queue* const q,
 		struct marks* const m, char* const line, size_t linesize) {
 	/* TODO document it */
 	static char* anykey = \
 		"; read -n1 -r -p \"Press any key to continue...\" key\n"
 		"if [ \"$key\" != '' ]; then echo; fi";
 	int e;
-	(void)(t);
 	const size_t line_len = strlen(line);
 	if (!line[0] || line[0] == '\n' || line[0] == '#') {
 		return;
@@ -742,10 +860,37 @@ static void interpreter(struct ui* const i, struct task* const t,
 		}
 	}
 	else if (!memcmp(line, "map ", 4)) {
-		// ...
+		if ((e = keymap_add(i, line+4))) {
+			failed(i, "map", strerror(e));
+		}
 	}
 	else if (!memcmp(line, "set ", 4)) {
-		// ...
+		if (!strcmp(line+4, "sync")) i->sync = true;
+		else if (!strcmp(line+4, "nosync")) i->sync = false;
+		else if (!strcmp(line+4, "lrmargins")) i->G.lrm = true;
+		else if (!strcmp(line+4, "nolrmargins")) i->G.lrm = false;
+		else if (!strcmp(line+4, "nocache")) i->nocache = true;
+		else if (!strcmp(line+4, "cache")) i->nocache = false;
+		else if (!strcmp(line+4, "journal")) i->journal = true;
+		else if (!strcmp(line+4, "nojournal")) i->journal = false;
+		else if (!strcmp(line+4, "uring")) i->uring = true;
+		else if (!strcmp(line+4, "nouring")) i->uring = false;
+		else if (!memcmp(line+4, "tasks ", 6)) {
+			const int n = atoi(line+10);
+			if (n < 1 || n > TASKS_MAX) failed(i, "set", "Invalid number");
+			else q->max = n;
+		}
+		else failed(i, "set", "Unknown option");
+	}
+	else if (!strcmp(line, "stats")) {
+		snprintf(i->msg, MSG_BUFFER_SIZE,
+			"frames: %lu, last: %zuB %u allocs %u syscalls, "
+			"total: %lluB, dropped: %lu, pending: %zuB",
+			i->os.frames, i->os.bytes, i->os.allocs,
+			i->os.syscalls, i->os.bytes_total,
+			i->os.dropped, i->os.pending);
+		i->mt = MSG_INFO;
+		i->dirty |= DIRTY_BOTTOMBAR;
 	}
 	else if (!strcmp(line, "noh") || !strcmp(line, "nos")) {
 		i->dirty |= DIRTY_PANELS | DIRTY_STATUSBAR;
@@ -848,9 +993,8 @@ static void chg_column(struct ui* const i) {
 	i->dirty |= DIRTY_PANELS | DIRTY_BOTTOMBAR;
 }
 
-static void cmd_command(struct ui* const i, struct task* const t,
+static void cmd_command(struct ui* const i, struct task_queue* const q,
 		struct marks* const m) {
-	(void)(t);
 	char cmd[1024];
 	memset(cmd, 0, sizeof(cmd));
 	char* t_top = cmd;
@@ -874,27 +1018,96 @@ static void cmd_command(struct ui* const i, struct task* const t,
 	}
 	i->dirty |= DIRTY_BOTTOMBAR;
 	i->prompt = NULL;
-	interpreter(i, t, m, cmd, sizeof(cmd));
+	interpreter(i, q, m, cmd, sizeof(cmd));
 }
 
-static void process_input(struct ui* const i, struct task* const t,
+/*
+ * Consumes repeats of c that are already waiting in input,
+ * so that held key moves the cursor once per frame
+ */
+static int repeats(struct ui* const i, const enum command c) {
+	int n = 0;
+	while (n < INPUT_BURST && input_pending()) {
+		const enum command nc = get_cmd(i);
+		if (nc != c) {
+			i->ahead = nc;
+			break;
+		}
+		n += 1;
+	}
+	return n;
+}
+
+/*
+ * Task list; commands apply to selected task
+ */
+static void task_list_input(struct ui* const i, struct task_queue* const q,
+		const enum command cmd) {
+	struct task* const t = (q->n ? &q->t[q->o[i->tls]] : NULL);
+	i->dirty |= DIRTY_TASKS;
+	switch (cmd) {
+	case CMD_TASK_QUIT:
+		if (t) task_message(t, TM_ABORT);
+		break;
+	case CMD_TASK_PAUSE:
+		if (t) task_message(t, TM_PAUSE);
+		break;
+	case CMD_TASK_RESUME:
+		if (t) task_resume(t);
+		break;
+	case CMD_TASK_RAISE:
+		task_queue_move(q, i->tls, -1);
+		if (i->tls > 0) i->tls -= 1;
+		break;
+	case CMD_TASK_LOWER:
+		task_queue_move(q, i->tls, 1);
+		if (i->tls < q->n-1) i->tls += 1;
+		break;
+	case CMD_ENTRY_DOWN:
+		if (i->tls < q->n-1) i->tls += 1;
+		break;
+	case CMD_ENTRY_UP:
+		if (i->tls > 0) i->tls -= 1;
+		break;
+	case CMD_ENTRY_FIRST:
+		i->tls = 0;
+		break;
+	case CMD_ENTRY_LAST:
+		i->tls = (q->n ? q->n-1 : 0);
+		break;
+	case CMD_TASKS:
+		i->m = MODE_MANAGER;
+		break;
+	default:
+		i->dirty &= ~DIRTY_TASKS;
+		break;
+	}
+}
+
+static void process_input(struct ui* const i, struct task_queue* const q,
 		struct marks* const m) {
 	char *s = NULL;
 	struct panel* tmp = NULL;
 	int err = 0;
 	fnum_t f;
+	/* Signal callbacks may draw while waiting for input */
+	const enum command cmd = get_cmd(i);
+	if (i->m == MODE_WAIT) {
+		task_list_input(i, q, cmd);
+		return;
+	}
 	i->dirty |= DIRTY_PANELS | DIRTY_STATUSBAR;
 	if (i->m == MODE_CHMOD) {
 		i->dirty |= DIRTY_STATUSBAR | DIRTY_BOTTOMBAR;
 	}
-	switch (get_cmd(i)) {
+	switch (cmd) {
 	/* CHMOD */
 	case CMD_RETURN:
 		chmod_close(i);
 		break;
 	case CMD_CHANGE:
 		i->dirty |= DIRTY_STATUSBAR | DIRTY_BOTTOMBAR;
-		prepare_task(i, t, TASK_CHMOD);
+		prepare_task(i, q, TASK_CHMOD);
 		break;
 	case CMD_CHOWN:
 		/* TODO in $VISUAL */
@@ -938,16 +1151,6 @@ static void process_input(struct ui* const i, struct task* const t,
 	case CMD_PL: _perm(i, false, 0777); break;
 	case CMD_MI: _perm(i, true, 0777); break;
 
-	/* WAIT */
-	case CMD_TASK_QUIT:
-		//t->done = true; // TODO
-		break;
-	case CMD_TASK_PAUSE:
-		t->ts = TS_PAUSED;
-		break;
-	case CMD_TASK_RESUME:
-		t->ts = TS_RUNNING;
-		break;
 	/* MANAGER */
 	case CMD_QUIT:
 		i->run = false;
@@ -980,16 +1183,16 @@ static void process_input(struct ui* const i, struct task* const t,
 		i->dirty |= DIRTY_PATHBAR;
 		break;
 	case CMD_ENTRY_DOWN:
-		jump_n_entries(i->pv, 1);
+		jump_n_entries(i->pv, 1+repeats(i, cmd));
 		break;
 	case CMD_ENTRY_UP:
-		jump_n_entries(i->pv, -1);
+		jump_n_entries(i->pv, -(1+repeats(i, cmd)));
 		break;
 	case CMD_SCREEN_DOWN:
-		jump_n_entries(i->pv, i->ph-1);
+		jump_n_entries(i->pv, (1+repeats(i, cmd))*(i->ph-1));
 		break;
 	case CMD_SCREEN_UP:
-		jump_n_entries(i->pv, -(i->ph-1));
+		jump_n_entries(i->pv, -(1+repeats(i, cmd))*(i->ph-1));
 		break;
 	case CMD_ENTER_DIR:
 		err = panel_enter_selected_dir(i->pv);
@@ -1010,16 +1213,27 @@ static void process_input(struct ui* const i, struct task* const t,
 		i->dirty |= DIRTY_PATHBAR;
 		break;
 	case CMD_COPY:
-		prepare_task(i, t, TASK_COPY);
+		prepare_task(i, q, TASK_COPY);
 		break;
 	case CMD_MOVE:
-		prepare_task(i, t, TASK_MOVE);
+		prepare_task(i, q, TASK_MOVE);
 		break;
 	case CMD_REMOVE:
-		prepare_task(i, t, TASK_REMOVE);
+		prepare_task(i, q, TASK_REMOVE);
 		break;
 	case CMD_COMMAND:
-		cmd_command(i, t, m);
+		cmd_command(i, q, m);
+		break;
+	case CMD_TASKS:
+		if (q->n) {
+			i->m = MODE_WAIT;
+			i->tls = 0;
+		}
+		else {
+			i->mt = MSG_INFO;
+			xstrlcpy(i->msg, "No tasks", MSG_BUFFER_SIZE);
+			i->dirty |= DIRTY_BOTTOMBAR;
+		}
 		break;
 	case CMD_CD:
 		cmd_cd(i);
@@ -1034,7 +1248,7 @@ static void process_input(struct ui* const i, struct task* const t,
 		cmd_mklnk(i);
 		break;
 	case CMD_DIR_VOLUME:
-		//estimate_volume_for_selected(i->pv);
+		cmd_volume(i);
 		break;
 	case CMD_SELECT_FILE:
 		if (panel_select_file(i->pv)) {
@@ -1122,23 +1336,160 @@ static void process_input(struct ui* const i, struct task* const t,
 	}
 }
 
-static void task_progress(struct ui* const i,
-		struct task* const t,
-		const char* const S) {
-	i->mt = MSG_INFO;
-	i->dirty |= DIRTY_BOTTOMBAR;
-	int n = snprintf(i->msg, MSG_BUFFER_SIZE,
-			"%s %d/%df, %d/%dd", S,
-			t->files_done, t->files_total,
-			t->dirs_done, t->dirs_total);
-	if (t->t & (TASK_REMOVE | TASK_MOVE | TASK_COPY)) {
+/*
+ * Progress is shown on timer ticks,
+ * not after every chunk of work
+ */
+#define PROGRESS_TICK_MS 100
+static int progress_timer = -1;
+static bool progress_due = true;
+
+static bool _progress_tick(int t, void* data) {
+	(void)(t);
+	*(bool*)data = true;
+	return true;
+}
+
+static void progress_start(void) {
+	if (progress_timer != -1) return;
+	progress_timer = loop_timer(PROGRESS_TICK_MS,
+			_progress_tick, &progress_due);
+}
+
+static void progress_stop(void) {
+	loop_timer_stop(progress_timer);
+	progress_timer = -1;
+	progress_due = true;
+}
+
+static const char* task_label(const struct task* const t) {
+	if (t->busy) return (t->onend == TS_CONFIRM ? "--" : ">>");
+	switch (t->ts) {
+	case TS_ESTIMATE: return "--";
+	case TS_CONFIRM: return "==";
+	case TS_QUEUED: return "..";
+	case TS_RUNNING: return ">>";
+	case TS_PAUSED: return "||";
+	case TS_FAILED: return "!!";
+	default: return "  ";
+	}
+}
+
+/*
+ * Duration in at most two units: 4.2s, 3m07s, 2h05m
+ */
+static int pretty_time(const unsigned long long ms,
+		char* const b, const int bs) {
+	const unsigned long long s = ms / 1000;
+	if (s < 60) return snprintf(b, bs, "%llu.%llus", s, ms % 1000 / 100);
+	if (s < 3600) return snprintf(b, bs, "%llum%02llus", s / 60, s % 60);
+	return snprintf(b, bs, "%lluh%02llum", s / 3600, s % 3600 / 60);
+}
+
+static int task_line(struct task* const t, char* const b, const int bs) {
+	struct task_progress p;
+	task_get_progress(t, &p);
+	int n = snprintf(b, bs, "%s %d/%df, %d/%dd", task_label(t),
+			p.files_done, p.files_total,
+			p.dirs_done, p.dirs_total);
+	if (t->t & (TASK_REMOVE | TASK_MOVE | TASK_COPY) && n < bs) {
 		char sdone[SIZE_BUF_SIZE];
 		char stota[SIZE_BUF_SIZE];
-		pretty_size(t->size_done, sdone);
-		pretty_size(t->size_total, stota);
-		n += snprintf(i->msg+n, MSG_BUFFER_SIZE-n,
-			", %s/%s", sdone, stota);
+		pretty_size(p.size_done, sdone);
+		pretty_size(p.size_total, stota);
+		n += snprintf(b+n, bs-n, ", %s/%s", sdone, stota);
+	}
+	if (t->t & (TASK_MOVE | TASK_COPY) && n < bs) {
+		char smove[SIZE_BUF_SIZE];
+		pretty_size(p.size_moved, smove);
+		n += snprintf(b+n, bs-n, " (%s moved)", smove);
+	}
+	if ((p.bps >= 1 || p.fps >= 1) && n < bs) {
+		char srate[SIZE_BUF_SIZE];
+		pretty_size(p.bps, srate);
+		n += snprintf(b+n, bs-n, ", %s/s %.0ff/s", srate, p.fps);
+	}
+	if (p.eta >= 0 && n < bs) {
+		char seta[16];
+		pretty_time(p.eta * 1000ULL, seta, sizeof(seta));
+		n += snprintf(b+n, bs-n, ", ETA %s", seta);
+	}
+	if (p.rbusy >= 0 && n < bs) {
+		n += snprintf(b+n, bs-n, ", read %d%% write %d%%",
+				p.rbusy, p.wbusy);
+	}
+	return (n < bs ? n : bs-1);
+}
+
+/*
+ * Task list shows every task in queue;
+ * otherwise bottom bar shows the first active one,
+ * unless there is some other message to show
+ */
+#define PROGRESS_HOLD_MS 2000
+static void tasks_show(struct ui* const i, struct task_queue* const q) {
+	static const char* const type[] = {
+		[TASK_REMOVE] = "remove",
+		[TASK_COPY] = "copy",
+		[TASK_MOVE] = "move",
+		[TASK_CHMOD] = "chmod",
+	};
+	static char last[MSG_BUFFER_SIZE];
+	static xtime_ms_t hold;
+	int a = -1; // First active
+	for (int j = q->n-1; j >= 0; --j) {
+		if (q->t[q->o[j]].busy) a = j;
+	}
+	if (a != -1) progress_start();
+	else progress_stop();
+	if (!q->n && i->m == MODE_WAIT) i->m = MODE_MANAGER;
+	const int tln = (i->m == MODE_WAIT ? q->n : 0);
+	if (tln != i->tln) {
+		i->tln = tln;
+		ui_update_geometry(i);
+	}
+	if (i->tls >= q->n) i->tls = (q->n ? q->n-1 : 0);
+	if (i->mt != MSG_NONE && strcmp(i->msg, last)) {
+		hold = xtime() + PROGRESS_HOLD_MS;
+	}
+	if (!progress_due) return;
+	progress_due = false;
+	if (i->m == MODE_WAIT) {
+		for (int j = 0; j < q->n && j < TASK_ROWS; ++j) {
+			struct task* const t = &q->t[q->o[j]];
+			char* const r = i->tl[j];
+			int n = snprintf(r, MSG_BUFFER_SIZE, "%d %-6s ",
+					j+1, type[t->t]);
+			n += task_line(t, r+n, MSG_BUFFER_SIZE-n);
+			if (t->sources.len && n < MSG_BUFFER_SIZE) {
+				snprintf(r+n, MSG_BUFFER_SIZE-n, "  %s%s",
+					t->sources.arr[0]->str,
+					(t->sources.len > 1 ? " ..." : ""));
+			}
+		}
+		i->dirty |= DIRTY_TASKS;
+		return;
+	}
+	if (!q->n || xtime() < hold) return;
+	if (a == -1) a = 0;
+	int n = 0;
+	if (q->n > 1) {
+		n = snprintf(i->msg, MSG_BUFFER_SIZE, "[%d/%d] ", a+1, q->n);
 	}
+	task_line(&q->t[q->o[a]], i->msg+n, MSG_BUFFER_SIZE-n);
+	memcpy(last, i->msg, MSG_BUFFER_SIZE);
+	i->mt = MSG_INFO;
+	i->dirty |= DIRTY_BOTTOMBAR;
+}
+
+/*
+ * Worker stopped; task needs UI
+ */
+static bool _task_stopped(int fd, short ev, void* data) {
+	(void)(fd);
+	(void)(ev);
+	task_join(data);
+	return true;
 }
 
 static void task_execute(struct ui* const i, struct task* const t) {
@@ -1175,15 +1526,11 @@ static void task_execute(struct ui* const i, struct task* const t) {
 		{ KUTF8("a"), "abort" },
 	};
 	static const char* const symlink_q = "There are symlinks";
+	/* Worker owns the task; only progress can be read */
+	if (t->busy || (t->ts & (TS_CLEAN | TS_QUEUED | TS_PAUSED))) return;
+	progress_due = true;
 	switch (t->ts) {
-	case TS_CLEAN:
-		break;
 	case TS_ESTIMATE:
-		i->timeout = 500;
-		i->m = MODE_WAIT;
-		task_progress(i, t, "--");
-		task_do(t, task_action_estimate, TS_CONFIRM);
-		if (t->err) t->ts = TS_FAILED;
 		if (t->tw.tws == AT_LINK && !(t->tf & (TF_ANY_LINK_METHOD))) {
 			if (t->t & (TASK_COPY | TASK_MOVE)) {
 				switch (ui_ask(i, symlink_q, symlink_o, 5)) {
@@ -1195,13 +1542,17 @@ static void task_execute(struct ui* const i, struct task* const t) {
 				default: break;
 				}
 			}
-			else if (t->t & TASK_REMOVE) {
+			else {
 				t->tf |= TF_RAW_LINKS; // TODO
 			}
 		}
+		if (t->ts == TS_ESTIMATE
+		&& (t->err = task_start(t, task_action_estimate, TS_CONFIRM))) {
+			t->ts = TS_FAILED;
+		}
 		break;
 	case TS_CONFIRM:
-		t->ts = TS_RUNNING;
+		t->ts = TS_QUEUED;
 		if (t->t == TASK_REMOVE) {
 			pretty_size(t->size_total, psize);
 			snprintf(msg, sizeof(msg),
@@ -1222,26 +1573,21 @@ static void task_execute(struct ui* const i, struct task* const t) {
 			default: break;
 			}
 		}
-		task_progress(i, t, "==");
 		break;
 	case TS_RUNNING:
-		i->timeout = 500;
 		if (t->t & (TASK_REMOVE | TASK_COPY | TASK_MOVE)) {
 			ta = task_action_copyremove;
 		}
 		else if (t->t == TASK_CHMOD) {
 			ta = task_action_chmod;
 		}
-		task_progress(i, t, ">>");
-		task_do(t, ta, TS_FINISHED);
-		break;
-	case TS_PAUSED:
-		i->timeout = -1;
-		task_progress(i, t, "||");
+		if ((t->err = task_start(t, ta, TS_FINISHED))) {
+			t->ts = TS_FAILED;
+		}
 		break;
 	case TS_FAILED:
 		snprintf(msg, sizeof(msg), "@ %s\r\n(%d) %s.",
-			t->tw.path, t->err, strerror(t->err));
+			(t->ep ? t->ep : t->tw.path), t->err, strerror(t->err));
 		if (t->err == EEXIST) {
 			switch (ui_ask(i, msg, manual_o, 4)) {
 			case 0:
@@ -1252,7 +1598,7 @@ static void task_execute(struct ui* const i, struct task* const t) {
 				t->tf |= TF_OVERWRITE_CONFLICTS;
 				break;
 			case 2:
-				t->err = tree_walk_step(&t->tw);
+				t->err = task_skip(t);
 				break;
 			case 3:
 				t->tf &= ~TF_ASK_CONFLICTS;
@@ -1267,7 +1613,7 @@ static void task_execute(struct ui* const i, struct task* const t) {
 				t->ts = TS_RUNNING;
 				break;
 			case 1:
-				t->err = tree_walk_step(&t->tw);
+				t->err = task_skip(t);
 				t->ts = TS_RUNNING;
 				break;
 			case 2:
@@ -1278,26 +1624,84 @@ static void task_execute(struct ui* const i, struct task* const t) {
 		t->err = 0;
 		break;
 	case TS_FINISHED:
-		i->timeout = -1;
 		if (ui_rescan(i, i->pv, i->sv)) {
 			if (t->t == TASK_MOVE) {
 				jump_n_entries(i->pv, -1);
 			}
 			pretty_size(t->size_done, psize);
 			i->mt = MSG_INFO;
-			snprintf(i->msg, MSG_BUFFER_SIZE,
+			int n = snprintf(i->msg, MSG_BUFFER_SIZE,
 				"processed %u files, %u dirs; %s",
 				t->files_done, t->dirs_done, psize);
+			if (t->cms) {
+				pretty_size(t->size_moved, psize);
+				n += snprintf(i->msg+n, MSG_BUFFER_SIZE-n,
+					", %s moved", psize);
+			}
+			const char* sep = " via ";
+			for (int b = 0; copy_method_names[b]
+					&& n < MSG_BUFFER_SIZE; ++b) {
+				if (!(t->cms & (1 << b))) continue;
+				n += snprintf(i->msg+n, MSG_BUFFER_SIZE-n, "%s%s",
+					sep, copy_method_names[b]);
+				sep = "+";
+			}
+			struct task_progress p;
+			task_get_progress(t, &p);
+			if (p.rbusy >= 0 && n < MSG_BUFFER_SIZE) {
+				n += snprintf(i->msg+n, MSG_BUFFER_SIZE-n,
+					" (read %d%% write %d%%)", p.rbusy, p.wbusy);
+			}
+			/* Estimate + run; data is the part of run
+			 * that moved file contents, the rest was metadata */
+			char ms[3][16];
+			pretty_time(p.ms[0], ms[0], sizeof(ms[0]));
+			pretty_time(p.ms[1], ms[1], sizeof(ms[1]));
+			pretty_time(p.data_ms, ms[2], sizeof(ms[2]));
+			if (n < MSG_BUFFER_SIZE) {
+				snprintf(i->msg+n, MSG_BUFFER_SIZE-n,
+					"; %s+%s, data %s in %llu calls",
+					ms[0], ms[1], ms[2], p.calls);
+			}
 		}
 		task_clean(t);
-		i->m = MODE_MANAGER;
 		break;
 	default:
 		break;
 	}
 }
 
-void read_config(struct ui* const i, struct task* const t,
+/*
+ * Gives every task in queue a chance to talk to the user,
+ * then starts those that may run
+ */
+static void tasks_execute(struct ui* const i, struct task_queue* const q) {
+	for (int j = 0; j < q->n; ++j) {
+		task_execute(i, &q->t[q->o[j]]);
+	}
+	struct task* t;
+	while ((t = task_queue_next(q))) {
+		task_execute(i, t);
+	}
+	task_queue_drop(q);
+	tasks_show(i, q);
+}
+
+/*
+ * Hund is about to exit; nobody will resume paused tasks
+ * Returns true if some worker still runs
+ */
+static bool tasks_quit(struct task_queue* const q) {
+	bool busy = false;
+	for (int j = 0; j < q->n; ++j) {
+		struct task* const t = &q->t[q->o[j]];
+		if (!t->busy && t->ts == TS_PAUSED) task_message(t, TM_ABORT);
+		busy |= t->busy;
+	}
+	return busy;
+}
+
+void read_config(struct ui* const i, struct task_queue* const q,
 		struct marks* const m, const char* const path) {
 	char buf[BUFSIZ];
 	size_t linelen;
@@ -1311,7 +1715,7 @@ void read_config(struct ui* const i, struct task* const t,
 			z = memchr(buf, '\n', rem);
 			*z = 0;
 			linelen = z - buf;
-			interpreter(i, t, m, buf, sizeof(buf));
+			interpreter(i, q, m, buf, sizeof(buf));
 			memmove(buf, z+1, rem-linelen);
 			rem -= linelen+1;
 		}
@@ -1404,9 +1808,17 @@ int main(int argc, char* argv[]) {
 		first_entry(&fvs[v]);
 	}
 
-	struct task t;
-	memset(&t, 0, sizeof(struct task));
-	t.in = t.out = -1;
+	static struct task_queue q;
+	err = task_queue_init(&q);
+	for (int k = 0; k < TASKS_MAX && !err; ++k) {
+		err = loop_fd(q.t[k].wfd[0], POLLIN, _task_stopped, &q.t[k]);
+	}
+	if (err) {
+		ui_end(&i);
+		fprintf(stderr, "failed to initialize task: (%d) %s\n",
+				err, strerror(err));
+		exit(EXIT_FAILURE);
+	}
 
 	struct marks m;
 	memset(&m, 0, sizeof(struct marks));
@@ -1428,7 +1840,7 @@ int main(int argc, char* argv[]) {
 			const size_t cpl = strlen(config_paths[cp]);
 			cd(p, &plen, config_paths[cp], cpl);
 			if (!access(p, F_OK)) {
-				read_config(&i, &t, &m, p);
+				read_config(&i, &q, &m, p);
 				break;
 			}
 			cp += 1;
@@ -1436,24 +1848,34 @@ int main(int argc, char* argv[]) {
 		free(p);
 	}
 	else if (!no_config) {
-		read_config(&i, &t, &m, config);
+		read_config(&i, &q, &m, config);
 	}
 
-	while (i.run || t.ts != TS_CLEAN) {
+	while (i.run || q.n) {
 		ui_draw(&i);
-		if (i.run) { // TODO
-			process_input(&i, &t, &m);
-		}
-		task_execute(&i, &t);
+		/* Process what is already in input before drawing;
+		 * limited, so that the screen is not frozen for too long */
+		int n = 0;
+		do {
+			if (i.run) { // TODO
+				process_input(&i, &q, &m);
+			}
+			else if (tasks_quit(&q)) {
+				loop_wait(-1, -1);
+			}
+			tasks_execute(&i, &q);
+			volume_update(&i);
+		} while (i.run && ++n < INPUT_BURST
+		&& (input_pending() || i.ahead != CMD_NONE));
 	}
 
+	volume_stop();
 	for (int v = 0; v < 2; ++v) {
 		delete_file_list(&fvs[v]);
 	}
 	marks_free(&m);
-	task_clean(&t);
+	task_queue_end(&q);
 	ui_end(&i);
 	memset(fvs, 0, sizeof(fvs));
-	memset(&t, 0, sizeof(struct task));
 	exit(EXIT_SUCCESS);
 }
@@ -70,9 +70,38 @@ void jump_n_entries(struct panel* const fv, const int n) {
 	} while (N);
 }
 
+static void _volumes_drop(struct panel* const fv) {
+	free(fv->vol);
+	free(fv->vwd);
+	fv->vol = NULL;
+	fv->vwd = NULL;
+	fv->nvol = 0;
+}
+
+static int _vol_cmp(const void* const a, const void* const b) {
+	const struct dir_volume* const x = a;
+	const struct dir_volume* const y = b;
+	if (x->dev != y->dev) return (x->dev < y->dev ? -1 : 1);
+	if (x->ino != y->ino) return (x->ino < y->ino ? -1 : 1);
+	return 0;
+}
+
+/*
+ * Volume of directory f, if it is in v (sorted by dev, ino)
+ */
+static struct dir_volume* _vol_find(const struct file* const f,
+		struct dir_volume* const v, const size_t n) {
+	if (!n || !S_ISDIR(f->s.st_mode)) return NULL;
+	struct dir_volume k;
+	k.dev = f->s.st_dev;
+	k.ino = f->s.st_ino;
+	return bsearch(&k, v, n, sizeof(struct dir_volume), _vol_cmp);
+}
+
 inline void delete_file_list(struct panel* const fv) {
 	file_list_clean(&fv->file_list, &fv->num_files);
 	fv->selection = fv->num_hidden = 0;
+	_volumes_drop(fv);
 }
 
 /*
@@ -166,11 +195,33 @@ void panel_toggle_hidden(struct panel* const fv) {
 	}
 }
 
+/*
+ * Directory that didn't change since it was measured
+ * shows its volume as size
+ */
+static bool _volume(struct file* const f, const struct dir_volume* const v) {
+	if (!v || f->s.st_ctim.tv_sec != v->ctim.tv_sec
+	|| f->s.st_ctim.tv_nsec != v->ctim.tv_nsec
+	|| (f->s.st_size == v->size && f->s.st_blocks == v->blocks)) {
+		return false;
+	}
+	f->s.st_size = v->size;
+	f->s.st_blocks = v->blocks;
+	free(f->c); // Shows old size
+	f->c = NULL;
+	return true;
+}
+
 int panel_scan_dir(struct panel* const fv) {
 	int err;
 	fv->num_selected = 0;
 	err = scan_dir(fv->wd, &fv->file_list, &fv->num_files, &fv->num_hidden);
 	if (err) return err;
+	if (fv->vwd && strcmp(fv->vwd, fv->wd)) _volumes_drop(fv);
+	for (fnum_t f = 0; fv->nvol && f < fv->num_files; ++f) {
+		_volume(fv->file_list[f],
+			_vol_find(fv->file_list[f], fv->vol, fv->nvol));
+	}
 	panel_sort(fv);
 	if (!fv->num_files) {
 		fv->selection = 0;
@@ -372,6 +423,38 @@ void panel_unselect_all(struct panel* const fv) {
 		fv->file_list[f]->selected = false;
 	}
 }
+
+/*
+ * Puts measured volumes (v is sorted here) on the list
+ * and remembers those that are on it, so that they survive rescans
+ * Sorted by size, list is sorted again; once for all of v
+ */
+void panel_volumes(struct panel* const fv, struct dir_volume* const v,
+		const size_t n) {
+	if (fv->vwd && strcmp(fv->vwd, fv->wd)) _volumes_drop(fv);
+	qsort(v, n, sizeof(struct dir_volume), _vol_cmp);
+	const size_t old = fv->nvol;
+	struct dir_volume* const vol = realloc(fv->vol,
+			(old+n) * sizeof(struct dir_volume));
+	const bool keep = vol && (fv->vwd || (fv->vwd = strdup(fv->wd)));
+	if (vol) fv->vol = vol;
+	bool found = false;
+	for (fnum_t f = 0; f < fv->num_files; ++f) {
+		const struct dir_volume* const nv = _vol_find(fv->file_list[f], v, n);
+		if (!nv) continue;
+		found |= _volume(fv->file_list[f], nv);
+		if (!keep) continue;
+		struct dir_volume* r = _vol_find(fv->file_list[f], fv->vol, old);
+		if (!r) r = &fv->vol[fv->nvol++];
+		*r = *nv;
+	}
+	if (fv->nvol != old) {
+		qsort(fv->vol, fv->nvol, sizeof(struct dir_volume), _vol_cmp);
+	}
+	if (found && memchr(fv->order, KEY_SIZE, FV_ORDER_SIZE)) {
+		panel_sorting_changed(fv);
+	}
+}
 /*
  * Needed by rename operation.
  * Checks conflicts with existing files and allows complicated swaps.
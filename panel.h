@@ -82,6 +82,9 @@ struct panel {
 	char order[FV_ORDER_SIZE];
 	enum column column;
 	bool show_hidden;
+	struct dir_volume* vol; // Measured directories of vwd; by dev, ino
+	size_t nvol;
+	char* vwd;
 };
 
 bool visible(const struct panel* const, const fnum_t);
@@ -117,6 +120,9 @@ void panel_selected_to_list(struct panel* const, struct string_list* const);
 void select_from_list(struct panel* const, const struct string_list* const);
 
 void panel_unselect_all(struct panel* const);
+
+void panel_volumes(struct panel* const, struct dir_volume* const,
+		const size_t);
 /*
  * TODO find a better name
  */
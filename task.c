@@ -19,6 +19,393 @@
 
 #include "task.h"
 
+struct small_copy {
+	char src[PATH_BUF_SIZE];
+	char dst[PATH_BUF_SIZE];
+	struct stat cs;
+	int sfd;
+	int r; // Result of job's operation in current round
+	bool retry; // Batch couldn't copy it; goes through regular path
+};
+
+struct uring_batch {
+	struct uring u;
+	struct small_copy* j; // URING_QD
+	size_t n;
+	char* buf; // URING_FILE_MAX per job
+	bool sync; // Retrying a job; don't queue it again
+};
+
+/*
+ * Followed by ctimes (if MF_TIMES) and name (unless AT_DIR_END)
+ */
+struct mf_rec {
+	unsigned short len; // Whole record, padded
+	unsigned char tws, fl;
+	mode_t mode;
+	off_t size;
+	struct timespec mtime;
+};
+
+static void _mf_drop(struct manifest* const m) {
+	free(m->b);
+	m->b = NULL;
+	m->len = m->cap = m->pos = m->last = 0;
+	m->s = MF_OFF;
+}
+
+static struct mf_rec* _mf_rec(const struct manifest* const m,
+		const size_t o) {
+	return (struct mf_rec*)(m->b + o);
+}
+
+static struct timespec* _mf_times(struct mf_rec* const r) {
+	return (struct timespec*)(r+1);
+}
+
+static char* _mf_name(struct mf_rec* const r) {
+	return (char*)(r+1) + (r->fl & MF_TIMES ? 2*sizeof(struct timespec) : 0);
+}
+
+/*
+ * Makes room for n more bytes
+ * Drops manifest if it would grow over MANIFEST_MAX
+ */
+static bool _mf_grow(struct manifest* const m, const size_t n) {
+	size_t cap = (m->cap ? m->cap : 256);
+	while (m->len + n > cap) cap *= 2;
+	if (cap == m->cap) return true;
+	char* const b = (cap > MANIFEST_MAX ? NULL : realloc(m->b, cap));
+	if (!b) {
+		_mf_drop(m);
+		return false;
+	}
+	m->b = b;
+	m->cap = cap;
+	return true;
+}
+
+/*
+ * Appends current entry; name == NULL for AT_DIR_END
+ */
+static void _mf_put(struct tree_walk* const tw,
+		const char* const name, const size_t nl, const unsigned fl) {
+	struct manifest* const m = tw->m;
+	size_t n = sizeof(struct mf_rec) + (name ? nl+1 : 0);
+	if (tw->tws == AT_DIR) n += 2*sizeof(struct timespec);
+	n = (n + 7) & ~(size_t)7;
+	if (!_mf_grow(m, n)) return;
+	struct mf_rec* const r = _mf_rec(m, m->len);
+	r->len = n;
+	r->tws = tw->tws;
+	r->fl = fl;
+	r->mode = tw->cs.st_mode;
+	r->size = tw->cs.st_size;
+	r->mtime = tw->cs.st_mtim;
+	if (tw->tws == AT_DIR) {
+		r->fl |= MF_TIMES;
+		_mf_times(r)[0] = tw->cs.st_ctim;
+		memset(&_mf_times(r)[1], 0, sizeof(struct timespec));
+	}
+	if (name) {
+		memcpy(_mf_name(r), name, nl);
+		_mf_name(r)[nl] = 0;
+	}
+	m->last = m->len;
+	m->len += n;
+}
+
+static bool _mf_on(const struct tree_walk* const tw,
+		const enum manifest_state s) {
+	return tw->m && tw->m->s == s;
+}
+
+/*
+ * Replays next record
+ */
+static void _mf_next(struct tree_walk* const tw) {
+	struct manifest* const m = tw->m;
+	if (m->pos >= m->len) {
+		tw->tws = AT_EXIT;
+		return;
+	}
+	const struct mf_rec* const r = _mf_rec(m, m->pos);
+	m->last = m->pos;
+	m->pos += r->len;
+	tw->tws = r->tws;
+	tw->fl = r->fl;
+	if (r->tws != AT_DIR_END) {
+		memset(&tw->cs, 0, sizeof(struct stat));
+		tw->cs.st_mode = r->mode;
+		tw->cs.st_size = r->size;
+		tw->cs.st_mtim = r->mtime;
+	}
+}
+
+/*
+ * Record of journal as it was read, before records
+ * of each path are folded into one journal_entry
+ */
+struct jn_rec {
+	const char* path;
+	char type;
+	long long v[3];
+};
+
+static int _jn_rec_cmp(const void* a, const void* b) {
+	const struct jn_rec* const x = a;
+	const struct jn_rec* const y = b;
+	const int r = strcmp(x->path, y->path);
+	if (r) return r;
+	return (x->path > y->path) - (x->path < y->path); // Keep order
+}
+
+static int _jn_cmp(const void* a, const void* b) {
+	const struct journal_entry* const x = a;
+	const struct journal_entry* const y = b;
+	return strcmp(x->path, y->path);
+}
+
+static bool _jn_num(char** const s, long long* const v) {
+	char* e;
+	errno = 0;
+	*v = strtoll(*s, &e, 10);
+	if (e == *s || *e != ' ' || errno) return false;
+	*s = e+1;
+	return true;
+}
+
+/*
+ * Reads what previous run recorded; torn last record is ignored
+ */
+static int _jn_load(struct journal* const j) {
+	struct stat s;
+	if (fstat(j->fd, &s)) return errno;
+	if (!s.st_size) return 0;
+	size_t len = 0, nr = 0;
+	if (!(j->b = malloc(s.st_size))) return ENOMEM;
+	while (len < (size_t)s.st_size) {
+		const ssize_t r = pread(j->fd, j->b+len, s.st_size-len, len);
+		if (r == -1 && errno == EINTR) continue;
+		if (r == -1) return errno;
+		if (!r) break;
+		len += r;
+	}
+	for (size_t o = 0; o < len; ++o) {
+		if (!j->b[o]) nr += 1;
+	}
+	struct jn_rec* const R = malloc(nr * sizeof(struct jn_rec));
+	if (nr && !R) return ENOMEM;
+	const int nv[] = { ['c'] = 3, ['o'] = 1, ['d'] = 0, ['m'] = 0 };
+	nr = 0;
+	for (size_t o = 0; o < len;) {
+		char* p = j->b+o;
+		const size_t l = strnlen(p, len-o);
+		if (o+l == len) break;
+		o += l+1;
+		if (l < 3 || !strchr("codm", p[0]) || p[1] != ' ') continue;
+		struct jn_rec* const r = &R[nr];
+		r->type = p[0];
+		p += 2;
+		int k = 0;
+		while (k < nv[(int)r->type] && _jn_num(&p, &r->v[k])) k += 1;
+		if (k < nv[(int)r->type] || !*p) continue;
+		r->path = p;
+		nr += 1;
+	}
+	qsort(R, nr, sizeof(struct jn_rec), _jn_rec_cmp);
+	if (nr && !(j->e = malloc(nr * sizeof(struct journal_entry)))) {
+		free(R);
+		return ENOMEM;
+	}
+	j->n = 0;
+	for (size_t k = 0; k < nr; ++k) {
+		struct journal_entry* e = (j->n ? &j->e[j->n-1] : NULL);
+		if (!e || strcmp(e->path, R[k].path)) {
+			e = &j->e[j->n++];
+			memset(e, 0, sizeof(struct journal_entry));
+			e->path = R[k].path;
+			e->size = -1;
+			e->st = JE_STARTED;
+		}
+		switch (R[k].type) {
+		case 'c':
+			e->size = R[k].v[0];
+			e->mtime.tv_sec = R[k].v[1];
+			e->mtime.tv_nsec = R[k].v[2];
+			e->off = 0;
+			e->st = JE_STARTED;
+			break;
+		case 'o':
+			e->off = R[k].v[0];
+			break;
+		case 'd':
+			e->st = JE_DONE;
+			break;
+		case 'm':
+			e->st = JE_MADE;
+			break;
+		}
+	}
+	free(R);
+	return 0;
+}
+
+/*
+ * What previous run did with path; NULL if nothing
+ */
+static const struct journal_entry* _jn_find(const struct journal* const j,
+		const char* const path, const size_t pathlen) {
+	if (!j->n || pathlen <= j->pl) return NULL;
+	struct journal_entry k;
+	k.path = path + j->pl;
+	return bsearch(&k, j->e, j->n, sizeof(struct journal_entry), _jn_cmp);
+}
+
+/*
+ * Queues record; s is needed for 'c', off for 'o'
+ */
+static void _jn_put(struct journal* const j, const char type,
+		const char* const path, const struct stat* const s, const off_t off) {
+	if (!j->rw) return;
+	char r[PATH_BUF_SIZE+80];
+	int n;
+	if (type == 'c') {
+		n = snprintf(r, sizeof(r), "c %lld %lld %ld %s",
+			(long long)s->st_size, (long long)s->st_mtim.tv_sec,
+			s->st_mtim.tv_nsec, path + j->pl);
+	}
+	else if (type == 'o') {
+		n = snprintf(r, sizeof(r), "o %lld %s",
+			(long long)off, path + j->pl);
+	}
+	else {
+		n = snprintf(r, sizeof(r), "%c %s", type, path + j->pl);
+	}
+	n = (n < (int)sizeof(r) ? n+1 : (int)sizeof(r));
+	r[n-1] = 0;
+	if (j->wl + n > j->wcap) {
+		const size_t cap = (j->wcap ? 2*j->wcap : 4096) + n;
+		char* const w = realloc(j->w, cap);
+		if (!w) return; // Resuming would only copy it again
+		j->w = w;
+		j->wcap = cap;
+	}
+	memcpy(j->w + j->wl, r, n);
+	j->wl += n;
+}
+
+static int _jn_flush(struct journal* const j) {
+	if (!j->wl) return 0;
+	size_t o = 0;
+	while (o < j->wl) {
+		const ssize_t r = write(j->fd, j->w+o, j->wl-o);
+		if (r == -1 && errno == EINTR) continue;
+		if (r == -1) return errno;
+		o += r;
+	}
+	j->wl = 0;
+	if (fdatasync(j->fd)) return errno;
+	return 0;
+}
+
+/*
+ * Journal is removed when the copy is done or when it says nothing;
+ * otherwise it stays for the next one
+ */
+static void _jn_end(struct journal* const j, const bool done) {
+	struct stat s;
+	if (j->fd != -1) {
+		_jn_flush(j);
+		if (j->rw && (done || (!fstat(j->fd, &s) && !s.st_size))) {
+			unlink(j->path);
+		}
+		close(j->fd);
+	}
+	free(j->path);
+	free(j->b);
+	free(j->e);
+	free(j->w);
+	memset(j, 0, sizeof(struct journal));
+	j->fd = -1;
+}
+
+static unsigned long long _fnv(unsigned long long h, const char* s) {
+	do {
+		h ^= (unsigned char)*s;
+		h *= 1099511628211ULL;
+	} while (*s++);
+	return h;
+}
+
+/*
+ * Opens journal of the same copy; same sources and destination
+ * Read only, it's not created; missing journal is empty.
+ * Opened again to append, what was read stays.
+ */
+static int _jn_open(struct task* const t, const bool rw) {
+	struct journal* const j = &t->j;
+	if (j->fd != -1) {
+		close(j->fd);
+		j->fd = -1;
+	}
+	if (j->path) {
+		j->fd = open(j->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+		if (j->fd == -1) return errno;
+		j->rw = true;
+		return 0;
+	}
+	unsigned long long h = _fnv(_fnv(14695981039346656037ULL, t->src), t->dst);
+	for (fnum_t k = 0; k < t->sources.len; ++k) {
+		h = _fnv(h, t->sources.arr[k]->str);
+		if (t->renamed.len && t->renamed.arr[k]) {
+			h = _fnv(h, t->renamed.arr[k]->str);
+		}
+	}
+	char p[PATH_BUF_SIZE];
+	const size_t sl = strnlen(t->src, PATH_MAX_LEN);
+	j->pl = sl + (sl && t->src[sl-1] != '/');
+	if (snprintf(p, sizeof(p), "%s/" JOURNAL_NAME, t->dst, h) >= (int)sizeof(p)) {
+		return ENAMETOOLONG;
+	}
+	if (!(j->path = strdup(p))) return ENOMEM;
+	j->fd = (rw ? open(p, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600)
+		: open(p, O_RDONLY | O_CLOEXEC));
+	if (j->fd == -1) return (!rw && errno == ENOENT ? 0 : errno);
+	j->rw = rw;
+	return _jn_load(j);
+}
+
+/*
+ * Journal is in destination directory; syncing its filesystem
+ * puts everything written there on disk
+ */
+static int _syncfs(const int fd) {
+#if defined(__linux__) && defined(SYS_syncfs)
+	return syscall(SYS_syncfs, fd);
+#else
+	(void)(fd);
+	sync();
+	return 0;
+#endif
+}
+
+/*
+ * Destination is on disk before journal says it's done
+ * Links aren't synced; link that didn't make it is not found,
+ * so it's made again
+ */
+static int _jn_done(struct task* const t, const char* const src) {
+	if (!t->j.rw) return 0;
+	if (t->in != -1 && fdatasync(t->in)) return errno;
+	_jn_put(&t->j, 'd', src, NULL, 0);
+	return 0;
+}
+
+static void _pool_end(struct task* const);
+static int _stat_file(struct tree_walk* const);
+static void _mounts_free(struct mount_point** const, size_t* const);
+
 xtime_ms_t xtime(void) {
 	struct timespec t;
 	clock_gettime(CLOCK_REALTIME, &t);
@@ -33,49 +420,276 @@ void task_new(struct task* const t, const enum task_type tp,
 	t->t = tp;
 	t->ts = TS_ESTIMATE;
 	t->tf = tf;
-	t->src = src; // TODO lengths
-	t->dst = dst;
+	t->src = strdup(src); // TODO lengths
+	t->dst = strdup(dst);
 	t->sources = *sources;
 	t->renamed = *renamed;
 	t->in = t->out = -1;
+#if defined(__linux__)
+	t->cm = CM_CLONE | CM_PIPE | CM_RANGE | CM_SENDFILE | CM_RW;
+	if (HAS_URING) t->cm |= CM_URING;
+#else
+	t->cm = CM_PIPE | CM_RW;
+#endif
+	t->cms = 0;
+	t->cp.use = false;
+	t->ep = NULL;
+	t->cp.bs = PIPE_BLOCK_MIN;
+	t->cp.depth = 2;
+	t->cp.rns = t->cp.wns = t->cp.ns = 0;
 	t->current_source = 0;
 	t->err = 0;
 	t->conflicts = t->symlinks = t->specials = 0;
-	t->size_total = t->size_done = 0;
+	t->size_total = t->size_done = t->size_moved = 0;
 	t->files_total = t->files_done = t->dirs_total = t->dirs_done = 0;
+	t->ns[0] = t->ns[1] = t->dns = t->calls = 0;
+	t->p.bps = t->p.fps = 0;
+	t->p.eta = -1;
 	t->chp = t->chm = 0;
 	t->cho = -1;
 	t->chg = -1;
 	memset(&t->tw, 0, sizeof(struct tree_walk));
+	_mf_drop(&t->mf);
+	t->mf.s = MF_RECORD;
+	memset(&t->j, 0, sizeof(struct journal));
+	t->j.fd = -1;
+	memset(&t->mv, 0, sizeof(struct move_plan));
+	t->seq = false;
+	t->started = false;
+	struct stat s;
+	if (stat(src, &s)) memset(&s, 0, sizeof(struct stat));
+	t->dev[0] = t->dev[1] = s.st_dev;
+	t->mf.top[0] = s.st_ctim;
+	if ((tp & (TASK_COPY | TASK_MOVE)) && !stat(dst, &s)) {
+		t->dev[1] = s.st_dev;
+		t->mf.top[1] = s.st_ctim;
+	}
+}
+
+static unsigned long long _ns_since(const struct timespec* const a) {
+	struct timespec b;
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	return (b.tv_sec - a->tv_sec) * 1000000000ULL + b.tv_nsec - a->tv_nsec;
+}
+
+/*
+ * Aims at 10-100ms per block: shorter reads are dominated
+ * by syscall overhead, longer ones make pausing sluggish.
+ * If both sides had to wait, devices take turns being slower
+ * and more blocks in flight smooth that out.
+ */
+static void _pipe_adapt(struct copy_pipe* const p,
+		const unsigned long long ns) {
+	if (ns < 10000000ULL && p->bs < PIPE_BLOCK_MAX) p->bs *= 2;
+	else if (ns > 100000000ULL && p->bs > PIPE_BLOCK_MIN) p->bs /= 2;
+	if (p->rd % 16) return;
+	if (p->rstalls && p->wstalls && p->depth < PIPE_SLOTS) p->depth += 1;
+	p->rstalls = p->wstalls = 0;
+}
+
+static void* _reader(void* arg) {
+	struct task* const t = arg;
+	struct copy_pipe* const p = &t->cp;
+	pthread_mutex_lock(&p->mx);
+	for (;;) {
+		if (p->rd - p->wr >= p->depth && !p->stop) {
+			p->rstalls += 1;
+			do {
+				pthread_cond_wait(&p->cv, &p->mx);
+			} while (p->rd - p->wr >= p->depth && !p->stop);
+		}
+		if (p->stop) break;
+		const unsigned s = p->rd % PIPE_SLOTS;
+		const size_t bs = p->bs;
+		pthread_mutex_unlock(&p->mx);
+		int e = 0;
+		size_t r = 0;
+		struct timespec a;
+		clock_gettime(CLOCK_MONOTONIC, &a);
+		if (!p->b[s] && (e = posix_memalign((void**)&p->b[s],
+				sysconf(_SC_PAGESIZE), PIPE_BLOCK_MAX))) {
+			p->b[s] = NULL;
+		}
+		while (!e && r < bs) {
+			const ssize_t n = read(t->out, p->b[s]+r, bs-r);
+			if (n > 0) r += n;
+			else if (!n) break;
+			else if (errno != EINTR) e = errno;
+		}
+		const unsigned long long ns = _ns_since(&a);
+		pthread_mutex_lock(&p->mx);
+		p->rns += ns;
+		if (r) {
+			p->len[s] = r;
+			p->rd += 1;
+		}
+		if (e) p->err = e;
+		else if (r < bs) p->eof = true;
+		else _pipe_adapt(p, ns);
+		pthread_cond_broadcast(&p->cv);
+		if (p->eof || p->err) break;
+	}
+	pthread_mutex_unlock(&p->mx);
+	return NULL;
+}
+
+/*
+ * Reader starts at current offset of source
+ * which is where writer is in destination
+ */
+static int _pipe_start(struct task* const t) {
+	struct copy_pipe* const p = &t->cp;
+	p->stop = p->eof = false;
+	p->err = 0;
+	p->rd = p->wr = 0;
+	p->rstalls = p->wstalls = 0;
+	p->off = lseek(t->out, 0, SEEK_CUR);
+	p->dlen = 0;
+	if (p->off == -1) return errno;
+	posix_fadvise(t->out, p->off, 0, POSIX_FADV_SEQUENTIAL);
+	clock_gettime(CLOCK_MONOTONIC, &p->start);
+	const int e = pthread_create(&p->th, NULL, _reader, t);
+	p->on = !e;
+	return e;
+}
+
+/*
+ * Leaves source at the offset writer reached,
+ * so that copying can continue after pause
+ */
+static void _pipe_stop(struct task* const t) {
+	struct copy_pipe* const p = &t->cp;
+	if (!p->on) return;
+	pthread_mutex_lock(&p->mx);
+	p->stop = true;
+	pthread_cond_broadcast(&p->cv);
+	pthread_mutex_unlock(&p->mx);
+	pthread_join(p->th, NULL);
+	p->on = false;
+	p->ns += _ns_since(&p->start);
+	if (t->out != -1) lseek(t->out, p->off, SEEK_SET);
+}
+
+/*
+ * Keeps a long copy from evicting everything else from page cache
+ * Source pages can go as soon as they are written.
+ * Destination pages are dirty; writeback is started right away
+ * and they are dropped one block later, when it should be done.
+ */
+static void _drop_cache(struct task* const t,
+		const off_t off, const size_t len) {
+	struct copy_pipe* const p = &t->cp;
+	if (!(t->tf & TF_NOCACHE)) return;
+	posix_fadvise(t->out, off, len, POSIX_FADV_DONTNEED);
+#if defined(__linux__) && defined(SYS_sync_file_range) && defined(__LP64__)
+	syscall(SYS_sync_file_range, t->in, off, len, 2); // WRITE
+	if (p->dlen) {
+		syscall(SYS_sync_file_range, t->in, p->doff, p->dlen, 1|2|4);
+	}
+#endif
+	if (p->dlen) posix_fadvise(t->in, p->doff, p->dlen, POSIX_FADV_DONTNEED);
+	p->doff = off;
+	p->dlen = len;
+}
+
+/*
+ * Writes blocks until at least n bytes are written
+ * Returns number of bytes written; 0 at the end of file; -1 on error
+ */
+static ssize_t _pipe_write(struct task* const t, const size_t n) {
+	struct copy_pipe* const p = &t->cp;
+	size_t done = 0;
+	while (done < n) {
+		pthread_mutex_lock(&p->mx);
+		if (p->rd == p->wr && !p->eof && !p->err) {
+			p->wstalls += 1;
+			do {
+				pthread_cond_wait(&p->cv, &p->mx);
+			} while (p->rd == p->wr && !p->eof && !p->err);
+		}
+		const bool empty = p->rd == p->wr;
+		const int e = p->err;
+		const unsigned s = p->wr % PIPE_SLOTS;
+		pthread_mutex_unlock(&p->mx);
+		if (empty) {
+			if (done || !e) break;
+			errno = e;
+			return -1;
+		}
+		struct timespec a;
+		clock_gettime(CLOCK_MONOTONIC, &a);
+		for (size_t w = 0; w < p->len[s];) {
+			const ssize_t wb = write(t->in, p->b[s]+w, p->len[s]-w);
+			if (wb > 0) w += wb;
+			else if (errno != EINTR) return -1;
+		}
+		p->wns += _ns_since(&a);
+		_drop_cache(t, p->off, p->len[s]);
+		p->off += p->len[s];
+		done += p->len[s];
+		pthread_mutex_lock(&p->mx);
+		p->wr += 1;
+		pthread_cond_broadcast(&p->cv);
+		pthread_mutex_unlock(&p->mx);
+	}
+	return done;
 }
 
 static void _close_files(struct task* const t) {
+	_pipe_stop(t);
+	t->cp.use = false;
 	if (t->in != -1) close(t->in);
 	if (t->out != -1) close(t->out);
 	t->in = t->out = -1;
 }
 
 void task_clean(struct task* const t) {
+	if (t->wp) _pool_end(t);
 	list_free(&t->sources);
 	list_free(&t->renamed);
+	free(t->src);
+	free(t->dst);
 	t->src = t->dst = NULL;
 	t->t = TASK_NONE;
 	t->tf = 0;
 	t->ts = TS_CLEAN;
 	t->conflicts = t->specials = t->err = 0;
 	_close_files(t);
+	free(t->buf);
+	t->buf = NULL;
+	for (int s = 0; s < PIPE_SLOTS; ++s) {
+		free(t->cp.b[s]);
+		t->cp.b[s] = NULL;
+	}
+	if (t->ub) {
+		uring_end(&t->ub->u);
+		free(t->ub->j);
+		free(t->ub->buf);
+		free(t->ub);
+		t->ub = NULL;
+	}
+	t->ep = NULL;
+	_mf_drop(&t->mf);
+	_jn_end(&t->j, false);
+	_mounts_free(&t->mv.mp, &t->mv.nmp);
+	free(t->mv.dev);
+	memset(&t->mv, 0, sizeof(struct move_plan));
 }
 
-int task_build_path(const struct task* const t, char* R) {
+/*
+ * Destination of entry tw is at, in k-th source
+ */
+static int _build_path(const struct task* const t, const fnum_t k,
+		const struct tree_walk* const tw, char* R) {
 	// TODO
 	// TODO be smarter about checking the length
 	const char* S = NULL;
 	const char* D = NULL;
 	size_t D_len = 0;
 	size_t old_len = strnlen(t->src, PATH_MAX_LEN);
-	if (t->renamed.len && t->renamed.arr[t->current_source]) {
-		S = t->sources.arr[t->current_source]->str;
-		D = t->renamed.arr[t->current_source]->str;
+	if (t->renamed.len && t->renamed.arr[k]) {
+		S = t->sources.arr[k]->str;
+		D = t->renamed.arr[k]->str;
 		D_len += strnlen(D, NAME_MAX_LEN);
 		old_len += 1+strnlen(S, NAME_MAX_LEN);
 	}
@@ -102,13 +716,13 @@ int task_build_path(const struct task* const t, char* R) {
 		memset(_R, 0, PATH_BUF_SIZE);
 		return ENAMETOOLONG;
 	}
-	const char* P = t->tw.path;
+	const char* P = tw->path;
 	P += old_len;
 	if (*P == '/') {
 		P += 1;
 		old_len -= 1;
 	}
-	const size_t ppart = t->tw.pathlen-old_len;
+	const size_t ppart = tw->pathlen-old_len;
 	if ((R - _R)+ppart > PATH_MAX_LEN) {
 		memset(_R, 0, PATH_BUF_SIZE);
 		return ENAMETOOLONG;
@@ -120,6 +734,10 @@ int task_build_path(const struct task* const t, char* R) {
 	return 0;
 }
 
+int task_build_path(const struct task* const t, char* R) {
+	return _build_path(t, t->current_source, &t->tw, R);
+}
+
 void task_action_chmod(struct task* const t, int* const c) {
 	switch (t->tw.tws) {
 	case AT_LINK:
@@ -144,6 +762,51 @@ void task_action_chmod(struct task* const t, int* const c) {
 	*c -= 1; // TODO
 }
 
+/*
+ * Flags current entry; existing destination directory is checked too
+ * before manifest is replayed
+ */
+static void _mf_conflict(struct tree_walk* const tw, const char* const np) {
+	if (!_mf_on(tw, MF_RECORD)) return;
+	struct mf_rec* const r = _mf_rec(tw->m, tw->m->last);
+	struct stat s;
+	r->fl |= MF_CONFLICT;
+	if ((r->fl & MF_TIMES) && !stat(np, &s)) _mf_times(r)[1] = s.st_ctim;
+}
+
+static int _mount(struct mount_point** const mp, size_t* const n,
+		const struct tree_walk* const tw) {
+	if (!(*n & (*n-1))) {
+		struct mount_point* const m = realloc(*mp,
+				(*n ? 2 * *n : 1) * sizeof(struct mount_point));
+		if (!m) return ENOMEM;
+		*mp = m;
+	}
+	if (!((*mp)[*n].path = strdup(tw->path))) return ENOMEM;
+	(*mp)[*n].dev = tw->cs.st_dev;
+	*n += 1;
+	return 0;
+}
+
+static void _mounts_free(struct mount_point** const mp, size_t* const n) {
+	for (size_t k = 0; k < *n; ++k) {
+		free((*mp)[k].path);
+	}
+	free(*mp);
+	*mp = NULL;
+	*n = 0;
+}
+
+/*
+ * Entry that is on other device than directory it is in
+ */
+static bool _mounted(const struct task* const t,
+		const struct tree_walk* const tw, const dev_t up) {
+	return (t->t & TASK_MOVE) && !(t->tf & TF_DEREF_LINKS)
+		&& (tw->tws & (AT_DIR | AT_FILE | AT_LINK | AT_SPECIAL))
+		&& tw->cs.st_dev != up;
+}
+
 void task_action_estimate(struct task* const t, int* const c) {
 	switch (t->tw.tws) {
 	case AT_LINK:
@@ -160,6 +823,8 @@ void task_action_estimate(struct task* const t, int* const c) {
 	case AT_DIR:
 		t->dirs_total += 1;
 		break;
+	case AT_DIR_END:
+		break;
 	default:
 		t->specials += 1;
 		break;
@@ -169,52 +834,1270 @@ void task_action_estimate(struct task* const t, int* const c) {
 		char new_path[PATH_BUF_SIZE];
 		task_build_path(t, new_path);
 		if (!access(new_path, F_OK)) {
-			t->conflicts += 1;
+			/* Previous run of the same copy made it */
+			if (!_jn_find(&t->j, t->tw.path, t->tw.pathlen)) {
+				t->conflicts += 1;
+			}
+			_mf_conflict(&t->tw, new_path);
 		}
 	}
-	t->size_total += t->tw.cs.st_size; // TODO
+	if (t->tw.tws != AT_DIR_END) t->size_total += t->tw.cs.st_size;
+	if (t->tw.dt && _mounted(t, &t->tw, t->tw.dt->dev)
+	&& (t->err = _mount(&t->mv.mp, &t->mv.nmp, &t->tw))) {
+		t->ts = TS_FAILED;
+		return;
+	}
 	*c -= 1;
 	if ((t->err = tree_walk_step(&t->tw))) {
 		t->ts = TS_FAILED;
 	}
 }
 
-void task_do(struct task* const t, task_action ta,
-		const enum task_state onend) {
-	int c;
-	if (t->ts & TS_ESTIMATE) {
-		c = 1024*2;
+/*
+ * Listing of a directory; records of its entries, followed
+ * by records of subdirectories, in units of their own
+ */
+struct walk_unit {
+	struct manifest m;
+	struct walk_unit** kids; // In order of their AT_DIR records
+	size_t nk;
+	fnum_t k; // Source
+	dev_t dev;
+	char path[];
+};
+
+struct walk_counts {
+	fnum_t files, dirs, symlinks, specials, conflicts;
+	ssize_t size;
+};
+
+struct walker {
+	pthread_t th;
+	struct walk_pool* p;
+	struct walk_unit** q; // Deque; owner takes from end, thieves from h
+	size_t h, n, cap;
+	struct walk_counts c; // Not yet added to pool's
+};
+
+struct walk_pool {
+	pthread_mutex_t mx; // Everything below, except t
+	pthread_cond_t work, done;
+	struct walker w[WALKERS];
+	int nw; // Walkers started
+	const struct task* t; // Only read while walkers run
+	struct walk_unit** su; // Per source; its top record and unit of it
+	size_t pending; // Units queued or being listed
+	size_t bytes; // Of all records
+	bool stop, deref;
+	bool paused; // Walkers take no more units
+	bool mf; // Units record entries for manifest
+	bool mounts; // Mount points are looked for; move_plan needs them
+	struct mount_point* mp;
+	size_t nmp;
+	int err;
+	struct walk_counts c;
+};
+
+static struct walk_unit* _unit(const char* const path, const size_t pl,
+		const fnum_t k) {
+	struct walk_unit* const u = malloc(sizeof(struct walk_unit) + pl+1);
+	if (!u) return NULL;
+	memset(u, 0, sizeof(struct walk_unit));
+	memcpy(u->path, path, pl+1);
+	u->k = k;
+	return u;
+}
+
+static void _unit_free(struct walk_unit* const u) {
+	if (!u) return;
+	for (size_t j = 0; j < u->nk; ++j) {
+		_unit_free(u->kids[j]);
+	}
+	free(u->kids);
+	free(u->m.b);
+	free(u);
+}
+
+/*
+ * Appends records of unit and its subdirectories in order of a tree walk
+ */
+static bool _stitch(struct manifest* const m, const struct walk_unit* const u) {
+	if (u->m.s != MF_RECORD) return false;
+	size_t o = 0, j = 0;
+	while (o < u->m.len) {
+		const struct mf_rec* const r = _mf_rec(&u->m, o);
+		if (!_mf_grow(m, r->len)) return false;
+		memcpy(m->b + m->len, r, r->len);
+		m->len += r->len;
+		o += r->len;
+		if (r->tws == AT_DIR && (j == u->nk || !_stitch(m, u->kids[j++]))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Counts entry tw is at, like task_action_estimate() does
+ */
+static void _tally(struct walk_counts* const c, struct tree_walk* const tw,
+		const struct task* const t, const fnum_t k) {
+	switch (tw->tws) {
+	case AT_LINK:
+		c->symlinks += 1;
+		c->files += 1;
+		break;
+	case AT_FILE:
+		c->files += 1;
+		break;
+	case AT_DIR:
+		c->dirs += 1;
+		break;
+	default:
+		c->specials += 1;
+		break;
+	}
+	c->size += tw->cs.st_size;
+	char np[PATH_BUF_SIZE];
+	if ((t->t & (TASK_COPY | TASK_MOVE))
+	&& (tw->tws & (AT_DIR | AT_LINK | AT_FILE))
+	&& !_build_path(t, k, tw, np) && !access(np, F_OK)) {
+		if (!_jn_find(&t->j, tw->path, tw->pathlen)) c->conflicts += 1;
+		_mf_conflict(tw, np);
+	}
+}
+
+static void _add_counts(struct walk_counts* const a,
+		struct walk_counts* const b) {
+	a->files += b->files;
+	a->dirs += b->dirs;
+	a->symlinks += b->symlinks;
+	a->specials += b->specials;
+	a->conflicts += b->conflicts;
+	a->size += b->size;
+	memset(b, 0, sizeof(struct walk_counts));
+}
+
+/*
+ * Queues unit to walker's deque; pool must be locked
+ */
+static int _give(struct walker* const w, struct walk_unit* const u) {
+	struct walk_pool* const p = w->p;
+	if (w->n == w->cap && w->h) {
+		memmove(w->q, w->q+w->h, (w->n-w->h) * sizeof(struct walk_unit*));
+		w->n -= w->h;
+		w->h = 0;
+	}
+	if (w->n == w->cap) {
+		const size_t cap = (w->cap ? 2*w->cap : 64);
+		struct walk_unit** const q = realloc(w->q,
+				cap * sizeof(struct walk_unit*));
+		if (!q) return ENOMEM;
+		w->q = q;
+		w->cap = cap;
+	}
+	w->q[w->n++] = u;
+	p->pending += 1;
+	pthread_cond_signal(&p->work);
+	return 0;
+}
+
+/*
+ * Newest unit of own deque or oldest of someone else's;
+ * pool must be locked
+ */
+static struct walk_unit* _take(struct walker* const w) {
+	struct walk_pool* const p = w->p;
+	if (w->n > w->h) return w->q[--w->n];
+	for (int j = 1; j < WALKERS; ++j) {
+		struct walker* const o = &p->w[(w - p->w + j) % WALKERS];
+		if (o->n > o->h) return o->q[o->h++];
+	}
+	return NULL;
+}
+
+static int _kid(struct walker* const w, struct walk_unit* const u,
+		const struct tree_walk* const tw) {
+	struct walk_pool* const p = w->p;
+	if (!(u->nk & (u->nk-1))) {
+		struct walk_unit** const kids = realloc(u->kids,
+				(u->nk ? 2*u->nk : 1) * sizeof(struct walk_unit*));
+		if (!kids) return ENOMEM;
+		u->kids = kids;
+	}
+	struct walk_unit* const d = _unit(tw->path, tw->pathlen, u->k);
+	if (!d) return ENOMEM;
+	d->dev = tw->cs.st_dev;
+	u->kids[u->nk++] = d;
+	pthread_mutex_lock(&p->mx);
+	const int e = _give(w, d);
+	pthread_mutex_unlock(&p->mx);
+	return e;
+}
+
+static void _list(struct walker* const w, struct walk_unit* const u) {
+	struct walk_pool* const p = w->p;
+	char path[PATH_BUF_SIZE];
+	struct tree_walk tw;
+	memset(&tw, 0, sizeof(struct tree_walk));
+	tw.path = path;
+	tw.pathlen = strnlen(u->path, PATH_MAX_LEN);
+	memcpy(path, u->path, tw.pathlen+1);
+	tw.tl = p->deref;
+	tw.m = &u->m; // Its state was set by _walk()
+	int e = 0;
+	fnum_t n = 0;
+	DIR* const d = opendir(path);
+	if (!d) e = errno;
+	while (!e) {
+		errno = 0;
+		const struct dirent* const ce = readdir(d);
+		if (!ce) {
+			e = errno;
+			break;
+		}
+		if (DOTDOT(ce->d_name)) continue;
+		const size_t nl = strnlen(ce->d_name, NAME_MAX_LEN);
+		pushd(path, &tw.pathlen, ce->d_name, nl);
+		if ((e = _stat_file(&tw))) break;
+		if (_mf_on(&tw, MF_RECORD)) _mf_put(&tw, ce->d_name, nl, 0);
+		_tally(&w->c, &tw, p->t, u->k);
+		if (tw.tws == AT_DIR && (e = _kid(w, u, &tw))) break;
+		if (p->mounts && _mounted(p->t, &tw, u->dev)) {
+			pthread_mutex_lock(&p->mx);
+			e = _mount(&p->mp, &p->nmp, &tw);
+			pthread_mutex_unlock(&p->mx);
+			if (e) break;
+		}
+		popd(path, &tw.pathlen);
+		if (++n % 1024) continue;
+		pthread_mutex_lock(&p->mx);
+		_add_counts(&p->c, &w->c);
+		if (p->stop) e = ECANCELED;
+		pthread_mutex_unlock(&p->mx);
+	}
+	if (d) closedir(d);
+	tw.tws = AT_DIR_END;
+	if (!e && _mf_on(&tw, MF_RECORD)) _mf_put(&tw, NULL, 0, 0);
+	char* const b = realloc(u->m.b, u->m.len);
+	if (b) u->m.b = b;
+	pthread_mutex_lock(&p->mx);
+	_add_counts(&p->c, &w->c);
+	p->bytes += u->m.len;
+	if (p->bytes > MANIFEST_MAX) p->mf = false;
+	if (e && e != ECANCELED && !p->err) p->err = e;
+	if (e) p->stop = true;
+	p->pending -= 1;
+	if (p->stop || !p->pending) {
+		pthread_cond_broadcast(&p->work);
+		pthread_cond_broadcast(&p->done);
+	}
+	pthread_mutex_unlock(&p->mx);
+}
+
+static void* _walk(void* arg) {
+	struct walker* const w = arg;
+	struct walk_pool* const p = w->p;
+	struct walk_unit* u;
+	pthread_mutex_lock(&p->mx);
+	while (!p->stop && p->pending) {
+		if (p->paused || !(u = _take(w))) {
+			pthread_cond_wait(&p->work, &p->mx);
+			continue;
+		}
+		u->m.s = (p->mf ? MF_RECORD : MF_OFF);
+		pthread_mutex_unlock(&p->mx);
+		_list(w, u);
+		pthread_mutex_lock(&p->mx);
+	}
+	pthread_mutex_unlock(&p->mx);
+	return NULL;
+}
+
+/*
+ * Paused walkers finish directories they list and wait
+ */
+static void _pool_pause(struct walk_pool* const p, const bool paused) {
+	pthread_mutex_lock(&p->mx);
+	p->paused = paused;
+	if (!paused) pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->mx);
+}
+
+static void _pool_end(struct task* const t) {
+	struct walk_pool* const p = t->wp;
+	pthread_mutex_lock(&p->mx);
+	p->stop = true;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->mx);
+	for (int j = 0; j < p->nw; ++j) {
+		pthread_join(p->w[j].th, NULL);
+	}
+	for (int j = 0; j < WALKERS; ++j) {
+		free(p->w[j].q);
+	}
+	for (fnum_t k = 0; p->su && k < t->sources.len; ++k) {
+		_unit_free(p->su[k]);
+	}
+	free(p->su);
+	_mounts_free(&p->mp, &p->nmp);
+	pthread_mutex_destroy(&p->mx);
+	pthread_cond_destroy(&p->work);
+	pthread_cond_destroy(&p->done);
+	free(p);
+	t->wp = NULL;
+}
+
+/*
+ * Counts top entries of sources (just like tree_walk_start()
+ * would see them) and lets walkers list those that are directories
+ * False if estimate has to walk alone
+ */
+static bool _pool_start(struct task* const t) {
+	if (t->seq || t->tw.tws != AT_NOWHERE || t->current_source
+	|| !(t->t & (TASK_COPY | TASK_MOVE | TASK_REMOVE))) {
+		return false;
+	}
+	t->seq = true;
+	struct walk_pool* const p = calloc(1, sizeof(struct walk_pool));
+	if (!p) return false;
+	pthread_mutex_init(&p->mx, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->done, NULL);
+	t->wp = p;
+	p->t = t;
+	p->deref = t->tf & TF_DEREF_LINKS;
+	p->mf = t->mf.s == MF_RECORD;
+	p->mounts = (t->t & TASK_MOVE) && !p->deref;
+	_mounts_free(&t->mv.mp, &t->mv.nmp);
+	for (int j = 0; j < WALKERS; ++j) {
+		p->w[j].p = p;
+	}
+	char path[PATH_BUF_SIZE];
+	struct tree_walk tw;
+	memset(&tw, 0, sizeof(struct tree_walk));
+	tw.path = path;
+	int e = !(p->su = calloc(t->sources.len, sizeof(struct walk_unit*)));
+	for (fnum_t k = 0; !e && k < t->sources.len; ++k) {
+		tw.pathlen = strnlen(t->src, PATH_MAX_LEN);
+		memcpy(path, t->src, tw.pathlen+1);
+		pushd(path, &tw.pathlen, t->sources.arr[k]->str,
+				t->sources.arr[k]->len);
+		struct walk_unit* const u = p->su[k] = _unit("", 0, k);
+		if (!u || _stat_file(&tw)) {
+			e = 1;
+			break;
+		}
+		tw.m = &u->m;
+		u->m.s = (p->mf ? MF_RECORD : MF_OFF);
+		if (p->mf) {
+			_mf_put(&tw, t->sources.arr[k]->str,
+					t->sources.arr[k]->len, MF_TOP);
+		}
+		_tally(&p->c, &tw, t, k);
+		if (tw.tws == AT_DIR) {
+			e = _kid(&p->w[k % WALKERS], u, &tw);
+		}
+	}
+	const bool dirs = p->pending;
+	while (!e && dirs && p->nw < WALKERS
+	&& !pthread_create(&p->w[p->nw].th, NULL, _walk, &p->w[p->nw])) {
+		p->nw += 1;
+	}
+	if (e || (dirs && !p->nw)) {
+		_pool_end(t);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Waits a moment for walkers and takes their counts
+ * When they're done, joins what they recorded into manifest
+ */
+static void _estimate_parallel(struct task* const t,
+		const enum task_state onend) {
+	struct walk_pool* const p = t->wp;
+	struct timespec at;
+	clock_gettime(CLOCK_REALTIME, &at);
+	at.tv_nsec += 100 * 1000000;
+	at.tv_sec += at.tv_nsec / 1000000000;
+	at.tv_nsec %= 1000000000;
+	pthread_mutex_lock(&p->mx);
+	while (p->pending && !p->stop
+	&& !pthread_cond_timedwait(&p->done, &p->mx, &at));
+	t->files_total = p->c.files;
+	t->dirs_total = p->c.dirs;
+	t->symlinks = p->c.symlinks;
+	t->specials = p->c.specials;
+	t->conflicts = p->c.conflicts;
+	t->size_total = p->c.size;
+	const bool busy = p->pending && !p->stop;
+	const bool mf = p->mf;
+	const int e = p->err;
+	pthread_mutex_unlock(&p->mx);
+	if (busy) return;
+	if (e || ((t->tf & TF_DEREF_LINKS) && !p->deref)) {
+		/* Walking alone reports errors as it finds them;
+		 * links that are to be followed were counted as links */
+		_pool_end(t);
+		t->seq = e;
+		t->tw.tws = AT_NOWHERE;
+		t->conflicts = t->symlinks = t->specials = 0;
+		t->files_total = t->dirs_total = t->size_total = 0;
+		return;
+	}
+	if (t->symlinks && !(t->tf & TF_ANY_LINK_METHOD)) {
+		t->tw.tws = AT_LINK; // UI asks
+		return;
+	}
+	bool ok = mf && t->mf.s == MF_RECORD;
+	for (fnum_t k = 0; ok && k < t->sources.len; ++k) {
+		ok = _stitch(&t->mf, p->su[k]);
+	}
+	if (ok) t->mf.s = MF_READY;
+	else _mf_drop(&t->mf);
+	t->mv.mp = p->mp;
+	t->mv.nmp = p->nmp;
+	p->mp = NULL;
+	p->nmp = 0;
+	_pool_end(t);
+	t->tw.tws = AT_NOWHERE;
+	t->ts = onend;
+}
+
+struct vol_unit {
+	struct vol_unit* next;
+	fnum_t k; // Measured directory
+	char path[];
+};
+
+struct vol_link {
+	dev_t dev;
+	ino_t ino;
+	fnum_t k;
+	bool used;
+};
+
+struct volume_pool {
+	pthread_mutex_t mx; // Everything below, except n and taken
+	pthread_cond_t work;
+	pthread_t th[WALKERS];
+	int nw; // Walkers started
+	struct vol_unit* q; // Stack of units of all directories
+	size_t pending; // Units queued or being listed
+	bool stop;
+	fnum_t n; // Measured directories
+	struct dir_volume* v;
+	size_t* left; // Units of each directory queued or being listed
+	fnum_t* fin; // Directories in order they were finished
+	fnum_t nfin, taken;
+	struct vol_link* ln; // Open addressing; inodes with more links
+	size_t nln, lcap;
+};
+
+/*
+ * False if inode was already counted in directory k; pool must be locked
+ */
+static bool _vol_once(struct volume_pool* const p,
+		const struct stat* const s, const fnum_t k) {
+	if (2*(p->nln+1) > p->lcap) {
+		const size_t cap = (p->lcap ? 2*p->lcap : 256);
+		struct vol_link* const ln = calloc(cap, sizeof(struct vol_link));
+		if (!ln) return true; // Rather count twice
+		for (size_t j = 0; j < p->lcap; ++j) {
+			if (!p->ln[j].used) continue;
+			size_t h = (p->ln[j].ino * 0x9E3779B97F4A7C15ULL
+				^ p->ln[j].dev ^ p->ln[j].k) & (cap-1);
+			while (ln[h].used) h = (h+1) & (cap-1);
+			ln[h] = p->ln[j];
+		}
+		free(p->ln);
+		p->ln = ln;
+		p->lcap = cap;
+	}
+	size_t h = (s->st_ino * 0x9E3779B97F4A7C15ULL
+		^ s->st_dev ^ k) & (p->lcap-1);
+	for (; p->ln[h].used; h = (h+1) & (p->lcap-1)) {
+		if (p->ln[h].ino == s->st_ino && p->ln[h].dev == s->st_dev
+		&& p->ln[h].k == k) {
+			return false;
+		}
+	}
+	p->ln[h].dev = s->st_dev;
+	p->ln[h].ino = s->st_ino;
+	p->ln[h].k = k;
+	p->ln[h].used = true;
+	p->nln += 1;
+	return true;
+}
+
+/*
+ * Pool must be locked
+ */
+static int _vol_push(struct volume_pool* const p,
+		const char* const path, const size_t pl, const fnum_t k) {
+	struct vol_unit* const u = malloc(sizeof(struct vol_unit) + pl+1);
+	if (!u) return ENOMEM;
+	memcpy(u->path, path, pl+1);
+	u->k = k;
+	u->next = p->q;
+	p->q = u;
+	p->pending += 1;
+	p->left[k] += 1;
+	pthread_cond_signal(&p->work);
+	return 0;
+}
+
+/*
+ * Sums entries of unit's directory; subdirectories become units
+ * Errors don't stop it; du(1) goes on too
+ */
+static void _vol_list(struct volume_pool* const p, struct vol_unit* const u) {
+	char path[PATH_BUF_SIZE];
+	size_t pl = strnlen(u->path, PATH_MAX_LEN);
+	memcpy(path, u->path, pl+1);
+	off_t size = 0;
+	blkcnt_t blocks = 0;
+	struct stat s;
+	int e = 0, ee;
+	fnum_t n = 0;
+	DIR* const d = opendir(path);
+	if (!d) e = errno;
+	while (d) {
+		errno = 0;
+		const struct dirent* const de = readdir(d);
+		if (!de) {
+			if (errno && !e) e = errno;
+			break;
+		}
+		if (DOTDOT(de->d_name)) continue;
+		const size_t nl = strnlen(de->d_name, NAME_MAX_LEN);
+		if ((ee = pushd(path, &pl, de->d_name, nl))) {
+			if (!e) e = ee;
+			continue;
+		}
+		bool once = true;
+		if (lstat(path, &s)) {
+			if (!e) e = errno;
+			once = false;
+		}
+		else if (S_ISDIR(s.st_mode) || s.st_nlink > 1) {
+			pthread_mutex_lock(&p->mx);
+			if (S_ISDIR(s.st_mode)) {
+				if ((ee = _vol_push(p, path, pl, u->k)) && !e) e = ee;
+			}
+			else {
+				once = _vol_once(p, &s, u->k);
+			}
+			pthread_mutex_unlock(&p->mx);
+		}
+		popd(path, &pl);
+		if (once) {
+			size += s.st_size;
+			blocks += s.st_blocks;
+		}
+		if (++n % 1024) continue;
+		pthread_mutex_lock(&p->mx);
+		const bool stop = p->stop;
+		pthread_mutex_unlock(&p->mx);
+		if (stop) break;
+	}
+	if (d) closedir(d);
+	pthread_mutex_lock(&p->mx);
+	struct dir_volume* const v = &p->v[u->k];
+	v->size += size;
+	v->blocks += blocks;
+	if (e && !v->err) v->err = e;
+	if (!(p->left[u->k] -= 1)) p->fin[p->nfin++] = u->k;
+	p->pending -= 1;
+	if (!p->pending) pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->mx);
+	free(u);
+}
+
+static void* _vol_walk(void* arg) {
+	struct volume_pool* const p = arg;
+	struct vol_unit* u;
+	pthread_mutex_lock(&p->mx);
+	while (!p->stop && p->pending) {
+		if (!(u = p->q)) {
+			pthread_cond_wait(&p->work, &p->mx);
+			continue;
+		}
+		p->q = u->next;
+		pthread_mutex_unlock(&p->mx);
+		_vol_list(p, u);
+		pthread_mutex_lock(&p->mx);
+	}
+	pthread_mutex_unlock(&p->mx);
+	return NULL;
+}
+
+/*
+ * Starts measuring named entries of wd; volume of anything
+ * other than directory is just what lstat() says
+ */
+int volume_start(struct volume_pool** const vp, const char* const wd,
+		const struct string_list* const names) {
+	struct volume_pool* const p = calloc(1, sizeof(struct volume_pool));
+	if (!p) return ENOMEM;
+	pthread_mutex_init(&p->mx, NULL);
+	pthread_cond_init(&p->work, NULL);
+	*vp = p;
+	p->n = names->len;
+	if (!(p->v = calloc(p->n, sizeof(struct dir_volume)))
+	|| !(p->left = calloc(p->n, sizeof(size_t)))
+	|| !(p->fin = calloc(p->n, sizeof(fnum_t)))) {
+		volume_end(vp);
+		return ENOMEM;
+	}
+	char path[PATH_BUF_SIZE];
+	struct stat s;
+	int e = 0;
+	for (fnum_t k = 0; !e && k < p->n; ++k) {
+		struct dir_volume* const v = &p->v[k];
+		size_t pl = strnlen(wd, PATH_MAX_LEN);
+		memcpy(path, wd, pl+1);
+		if ((v->err = pushd(path, &pl, names->arr[k]->str,
+				names->arr[k]->len))
+		|| (lstat(path, &s) && (v->err = errno))) {
+			p->fin[p->nfin++] = k;
+			continue;
+		}
+		v->dev = s.st_dev;
+		v->ino = s.st_ino;
+		v->ctim = s.st_ctim;
+		v->size = s.st_size;
+		v->blocks = s.st_blocks;
+		if (!S_ISDIR(s.st_mode)) p->fin[p->nfin++] = k;
+		else e = _vol_push(p, path, pl, k);
+	}
+	while (!e && p->pending && p->nw < WALKERS
+	&& !pthread_create(&p->th[p->nw], NULL, _vol_walk, p)) {
+		p->nw += 1;
+	}
+	if (e || (p->pending && !p->nw)) {
+		volume_end(vp);
+		return (e ? e : EAGAIN);
+	}
+	return 0;
+}
+
+/*
+ * Copies up to max volumes finished since last time; 0 if none
+ */
+fnum_t volume_take(struct volume_pool* const p,
+		struct dir_volume* const v, const fnum_t max) {
+	fnum_t n = 0;
+	pthread_mutex_lock(&p->mx);
+	while (n < max && p->taken < p->nfin) {
+		v[n++] = p->v[p->fin[p->taken++]];
+	}
+	pthread_mutex_unlock(&p->mx);
+	return n;
+}
+
+bool volume_finished(const struct volume_pool* const p) {
+	return p->taken == p->n;
+}
+
+void volume_end(struct volume_pool** const vp) {
+	struct volume_pool* const p = *vp;
+	if (!p) return;
+	pthread_mutex_lock(&p->mx);
+	p->stop = true;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->mx);
+	for (int j = 0; j < p->nw; ++j) {
+		pthread_join(p->th[j], NULL);
+	}
+	while (p->q) {
+		struct vol_unit* const u = p->q;
+		p->q = u->next;
+		free(u);
+	}
+	free(p->ln);
+	free(p->v);
+	free(p->left);
+	free(p->fin);
+	pthread_mutex_destroy(&p->mx);
+	pthread_cond_destroy(&p->work);
+	free(p);
+	*vp = NULL;
+}
+
+static size_t _queued(const struct task* const t) {
+	return t->ub ? t->ub->n : 0;
+}
+
+static bool _same_time(const struct timespec* const a,
+		const struct timespec* const b) {
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/*
+ * Manifest is fresh if none of directories it saw changed since;
+ * for copy also destination directories that already existed.
+ * Checking takes one stat() per directory, walking takes
+ * readdir() of each directory and lstat() of every entry.
+ */
+static bool _mf_fresh(struct task* const t) {
+	struct manifest* const m = &t->mf;
+	const bool cp = t->t & (TASK_COPY | TASK_MOVE);
+	char np[PATH_BUF_SIZE];
+	struct stat s;
+	bool ok = !stat(t->src, &s) && _same_time(&s.st_ctim, &m->top[0]);
+	if (ok && cp) {
+		ok = !stat(t->dst, &s) && _same_time(&s.st_ctim, &m->top[1]);
+	}
+	m->s = MF_REPLAY;
+	m->pos = 0;
+	for (fnum_t k = 0; ok && k < t->sources.len; ++k) {
+		t->current_source = k;
+		t->tw.m = m;
+		tree_walk_start(&t->tw, t->src, t->sources.arr[k]->str,
+				t->sources.arr[k]->len);
+		while (ok && t->tw.tws != AT_EXIT) {
+			if (t->tw.tws == AT_DIR) {
+				struct timespec* const tm = _mf_times(_mf_rec(m, m->last));
+				ok = !stat(t->tw.path, &s)
+					&& _same_time(&s.st_ctim, &tm[0]);
+				if (ok && cp && (t->tw.fl & MF_CONFLICT)) {
+					ok = !task_build_path(t, np) && !stat(np, &s)
+						&& _same_time(&s.st_ctim, &tm[1]);
+				}
+			}
+			tree_walk_step(&t->tw);
+		}
+	}
+	tree_walk_end(&t->tw);
+	t->current_source = 0;
+	m->pos = 0;
+	return ok;
+}
+
+/*
+ * Devices of destination and of each source; once per move
+ * Links that are to be followed can't be renamed
+ */
+static void _plan(struct task* const t) {
+	struct move_plan* const p = &t->mv;
+	struct stat s;
+	char path[PATH_BUF_SIZE];
+	p->planned = true;
+	if ((t->tf & TF_DEREF_LINKS) || stat(t->dst, &s)
+	|| !(p->dev = malloc(t->sources.len * sizeof(dev_t)))) {
+		return;
+	}
+	p->ddev = s.st_dev;
+	for (fnum_t k = 0; k < t->sources.len; ++k) {
+		size_t pl = strnlen(t->src, PATH_MAX_LEN);
+		memcpy(path, t->src, pl+1);
+		pushd(path, &pl, t->sources.arr[k]->str, t->sources.arr[k]->len);
+		p->dev[k] = (lstat(path, &s) ? p->ddev + 1 : s.st_dev); // Not ddev
+	}
+}
+
+void task_do(struct task* const t, task_action ta,
+		const enum task_state onend) {
+	int c;
+	if (t->ts & TS_ESTIMATE) {
+		c = 1024*2;
+	}
+	else {
+		c = 1024 * 1024 * 16;
+	}
+	/* Copy goes on without journal if it can't have one */
+	if ((t->tf & TF_JOURNAL) && (t->t & (TASK_COPY | TASK_MOVE))
+	&& (!t->j.path || (!t->j.rw && !(t->ts & TS_ESTIMATE)))
+	&& _jn_open(t, !(t->ts & TS_ESTIMATE))) {
+		_jn_end(&t->j, false);
+		t->tf &= ~TF_JOURNAL;
+	}
+	/* Manifest has links that are to be followed,
+	 * or estimate didn't finish, or something changed since */
+	if (((t->tf & TF_DEREF_LINKS) && t->mf.s == MF_RECORD)
+	|| (!(t->ts & TS_ESTIMATE) && (t->mf.s == MF_RECORD
+	|| (t->mf.s == MF_READY && !_mf_fresh(t))))) {
+		_mf_drop(&t->mf);
+	}
+	if ((t->t & TASK_MOVE) && !(t->ts & TS_ESTIMATE) && !t->mv.planned) {
+		_plan(t);
+	}
+	if ((t->ts & TS_ESTIMATE) && (t->wp || _pool_start(t))) {
+		_estimate_parallel(t, onend);
+		return;
+	}
+	if (t->tw.tws == AT_NOWHERE) {
+		t->tw.m = &t->mf;
+		t->err = tree_walk_start(&t->tw, t->src,
+			t->sources.arr[t->current_source]->str,
+			t->sources.arr[t->current_source]->len);
+		if (t->err) {
+			t->tw.tws = AT_NOWHERE;
+			t->ts = TS_FAILED;
+			return;
+		}
+	}
+	if (t->tf & TF_DEREF_LINKS) {
+		t->tw.tl = true;
+	}
+	while ((t->tw.tws != AT_EXIT || _queued(t)) && !t->err && c > 0) {
+		ta(t, &c);
+	}
+	if (t->err) {
+		t->ts = TS_FAILED;
+	}
+	else if (t->tw.tws == AT_EXIT && !_queued(t)) {
+		t->current_source += 1;
+		t->tw.tws = AT_NOWHERE;
+		if (t->current_source == t->sources.len) {
+			if (t->mf.s == MF_RECORD) t->mf.s = MF_READY;
+			if (t->mv.skipped) {
+				t->size_done = t->size_total;
+				t->files_done = t->files_total;
+				t->dirs_done = t->dirs_total;
+			}
+			if (!(t->ts & TS_ESTIMATE)) _jn_end(&t->j, true);
+			t->ts = onend;
+			tree_walk_end(&t->tw);
+			t->current_source = 0;
+		}
+	}
+	_jn_flush(&t->j);
+}
+
+/*
+ * Exponential moving averages of speed, and time left at that speed
+ */
+static void _rates(struct task* const t) {
+	struct task_progress* const p = &t->p;
+	const unsigned long long ns = _ns_since(&t->rat);
+	if ((t->ts & TS_RUNNING) && ns >= RATE_MS * 1000000ULL) {
+		const double s = ns / 1e9;
+		const double b = (t->size_done - t->rsize) / s;
+		const double f = (t->files_done - t->rfiles) / s;
+		const double a = (p->bps || p->fps ? s / (s + RATE_AVG_MS/1e3) : 1);
+		p->bps += a * (b - p->bps);
+		p->fps += a * (f - p->fps);
+		clock_gettime(CLOCK_MONOTONIC, &t->rat);
+		t->rsize = t->size_done;
+		t->rfiles = t->files_done;
+	}
+	double eta = -1;
+	if (p->bps >= 1 && t->size_total > t->size_done) {
+		eta = (t->size_total - t->size_done) / p->bps;
+	}
+	if (p->fps >= 0.01 && t->files_total > t->files_done) {
+		const double e = (t->files_total - t->files_done) / p->fps;
+		if (e > eta) eta = e;
+	}
+	p->eta = (t->ts & TS_RUNNING ? (long)eta : -1);
+}
+
+static void _publish(struct task* const t) {
+	t->p.size_total = t->size_total;
+	t->p.size_done = t->size_done;
+	t->p.size_moved = t->size_moved;
+	t->p.files_total = t->files_total;
+	t->p.files_done = t->files_done;
+	t->p.dirs_total = t->dirs_total;
+	t->p.dirs_done = t->dirs_done;
+	t->p.ms[0] = t->ns[0] / 1000000;
+	t->p.ms[1] = t->ns[1] / 1000000;
+	t->p.data_ms = t->dns / 1000000;
+	t->p.calls = t->calls;
+	_rates(t);
+	const struct copy_pipe* const p = &t->cp;
+	const unsigned long long ns = p->ns + (p->on ? _ns_since(&p->start) : 0);
+	t->p.rbusy = t->p.wbusy = -1;
+	if (ns) {
+		pthread_mutex_lock(&t->cp.mx);
+		t->p.rbusy = p->rns * 100 / ns;
+		pthread_mutex_unlock(&t->cp.mx);
+		t->p.wbusy = p->wns * 100 / ns;
+	}
+}
+
+/*
+ * Estimate stops at first symlink if it is not known
+ * what to do with symlinks; UI has to ask
+ */
+static bool _needs_ui(const struct task* const t,
+		const enum task_state ts) {
+	return t->ts != ts || (t->tw.tws == AT_LINK
+		&& !(t->tf & TF_ANY_LINK_METHOD) && (ts & TS_ESTIMATE));
+}
+
+static void* _worker(void* arg) {
+	struct task* const t = arg;
+	const enum task_state ts = t->ts;
+	enum task_msg m;
+	do {
+		const int ph = !(t->ts & TS_ESTIMATE);
+		struct timespec a;
+		clock_gettime(CLOCK_MONOTONIC, &a);
+		task_do(t, t->ta, t->onend);
+		t->ns[ph] += _ns_since(&a);
+		pthread_mutex_lock(&t->mx);
+		_publish(t);
+		m = t->msg;
+		pthread_mutex_unlock(&t->mx);
+	} while (m == TM_NONE && !_needs_ui(t, ts));
+	const ssize_t w = write(t->wfd[1], "", 1);
+	(void)(w);
+	return NULL;
+}
+
+int task_init(struct task* const t) {
+	memset(t, 0, sizeof(struct task));
+	t->in = t->out = -1;
+	if (pipe(t->wfd)) return errno;
+	fcntl(t->wfd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(t->wfd[1], F_SETFD, FD_CLOEXEC);
+	int e;
+	if ((e = pthread_mutex_init(&t->mx, NULL))
+	|| (e = pthread_mutex_init(&t->cp.mx, NULL))) return e;
+	return pthread_cond_init(&t->cp.cv, NULL);
+}
+
+void task_end(struct task* const t) {
+	if (t->busy) {
+		task_message(t, TM_ABORT);
+		task_join(t);
+	}
+	task_clean(t);
+	close(t->wfd[0]);
+	close(t->wfd[1]);
+	pthread_mutex_destroy(&t->mx);
+	pthread_mutex_destroy(&t->cp.mx);
+	pthread_cond_destroy(&t->cp.cv);
+}
+
+/*
+ * Runs task_do() in a loop on worker thread
+ * until the task needs UI (state changes, question)
+ * or until it is paused/aborted with task_message()
+ * task_join() has to be called after worker signals wfd[0]
+ */
+int task_start(struct task* const t, task_action ta,
+		const enum task_state onend) {
+	if (t->busy) return 0;
+	t->ta = ta;
+	t->onend = onend;
+	t->msg = TM_NONE;
+	/* Time spent waiting doesn't slow the task down */
+	clock_gettime(CLOCK_MONOTONIC, &t->rat);
+	t->rsize = t->size_done;
+	t->rfiles = t->files_done;
+	_publish(t);
+	const int e = pthread_create(&t->th, NULL, _worker, t);
+	if (!e) t->busy = true;
+	return e;
+}
+
+static void _apply_message(struct task* const t) {
+	switch (t->msg) {
+	case TM_PAUSE:
+		if (t->ts & (TS_ESTIMATE | TS_RUNNING | TS_QUEUED)) {
+			t->resume = (t->ts == TS_ESTIMATE ? TS_ESTIMATE : TS_QUEUED);
+			t->ts = TS_PAUSED;
+			if (t->wp) _pool_pause(t->wp, true);
+		}
+		_pipe_stop(t);
+		break;
+	case TM_ABORT:
+		_close_files(t);
+		t->ts = TS_FINISHED;
+		break;
+	default:
+		break;
+	}
+	t->msg = TM_NONE;
+}
+
+void task_join(struct task* const t) {
+	if (!t->busy) return;
+	char b;
+	while (read(t->wfd[0], &b, 1) == -1 && errno == EINTR);
+	pthread_join(t->th, NULL);
+	t->busy = false;
+	_apply_message(t);
+}
+
+void task_message(struct task* const t, const enum task_msg m) {
+	pthread_mutex_lock(&t->mx);
+	t->msg = m;
+	pthread_mutex_unlock(&t->mx);
+	if (!t->busy) _apply_message(t);
+}
+
+/*
+ * Paused task goes back to where it was paused:
+ * estimate goes on, confirmed task waits in queue
+ */
+void task_resume(struct task* const t) {
+	if (t->busy || t->ts != TS_PAUSED) return;
+	t->ts = t->resume;
+	if (t->wp) _pool_pause(t->wp, false);
+}
+
+void task_get_progress(struct task* const t, struct task_progress* const p) {
+	if (!t->busy) _publish(t);
+	pthread_mutex_lock(&t->mx);
+	*p = t->p;
+	pthread_mutex_unlock(&t->mx);
+}
+
+/*
+ * Is one path inside the other (or are they the same)?
+ */
+static bool _nested(const char* a, size_t al, const char* b, size_t bl) {
+	if (al > bl) {
+		const char* const s = a;
+		a = b;
+		b = s;
+		const size_t sl = al;
+		al = bl;
+		bl = sl;
+	}
+	while (al > 1 && a[al-1] == '/') al -= 1;
+	if (al == 1 && a[0] == '/') return true;
+	return !memcmp(a, b, al) && (al == bl || b[al] == '/');
+}
+
+/*
+ * k-th path that task touches; sources first, then destinations
+ * Returns 0 if there is no such path,
+ * 1 if task only reads it, 2 if task modifies it
+ */
+static int _touch(const struct task* const t, const fnum_t k,
+		char* const p, size_t* const pl) {
+	const fnum_t n = t->sources.len;
+	const char* d = t->src;
+	const struct string* f;
+	int w = (t->t == TASK_COPY ? 1 : 2);
+	if (k < n) {
+		f = t->sources.arr[k];
+	}
+	else if (k < 2*n && (t->t & (TASK_COPY | TASK_MOVE))) {
+		d = t->dst;
+		w = 2;
+		f = t->sources.arr[k-n];
+		if (t->renamed.len && t->renamed.arr[k-n]) {
+			f = t->renamed.arr[k-n];
+		}
+	}
+	else {
+		return 0;
+	}
+	const size_t dl = strlen(d);
+	const int r = snprintf(p, PATH_BUF_SIZE, "%s%s%s", d,
+			(dl && d[dl-1] == '/' ? "" : "/"), f->str);
+	*pl = (r < 0 || r >= PATH_BUF_SIZE ? PATH_MAX_LEN : (size_t)r);
+	return w;
+}
+
+struct touch {
+	char* p;
+	size_t l;
+	unsigned m; // TOUCH_* of task that touches it
+};
+
+#define TOUCH_READ(t) (1u << 2*(t))
+#define TOUCH_WRITE(t) (2u << 2*(t))
+
+/*
+ * '/' goes before anything else,
+ * so that whatever is inside a directory follows it right away
+ */
+static int _touch_cmp(const void* const x, const void* const y) {
+	const unsigned char* a = (const unsigned char*)((const struct touch*)x)->p;
+	const unsigned char* b = (const unsigned char*)((const struct touch*)y)->p;
+	while (*a && *a == *b) {
+		a += 1;
+		b += 1;
+	}
+	return (*a == '/' ? 1 : *a) - (*b == '/' ? 1 : *b);
+}
+
+/*
+ * Can't run at the same time:
+ * one of them modifies what the other one touches
+ * Paths of both are sorted together; walking them in order,
+ * a stack holds directories that contain current path,
+ * with what each task does to any of them.
+ */
+bool task_overlap(const struct task* const a, const struct task* const b) {
+	const size_t al = strlen(a->src), bl = strlen(b->src);
+	if (!_nested(a->src, al, b->src, bl)
+	&& !_nested(a->src, al, b->dst, strlen(b->dst))
+	&& !_nested(a->dst, strlen(a->dst), b->src, bl)
+	&& !_nested(a->dst, strlen(a->dst), b->dst, strlen(b->dst))) {
+		return false;
+	}
+	const size_t max = 2 * (a->sources.len + b->sources.len);
+	struct touch* const T = calloc(max, sizeof(struct touch));
+	struct touch* const S = calloc(max, sizeof(struct touch));
+	char p[PATH_BUF_SIZE];
+	size_t n = 0, pl;
+	int w;
+	bool ov = max && (!T || !S); // Can't tell; better wait
+	for (int t = 0; t < 2 && !ov; ++t) {
+		const struct task* const x = (t ? b : a);
+		for (fnum_t k = 0; (w = _touch(x, k, p, &pl)); ++k) {
+			if (!(T[n].p = malloc(pl+1))) {
+				ov = true;
+				break;
+			}
+			memcpy(T[n].p, p, pl);
+			T[n].p[pl] = 0;
+			T[n].l = pl;
+			T[n].m = (w == 2 ? TOUCH_WRITE(t) : 0) | TOUCH_READ(t);
+			n += 1;
+		}
+	}
+	if (!ov) qsort(T, n, sizeof(struct touch), _touch_cmp);
+	size_t sn = 0;
+	for (size_t k = 0; k < n && !ov; ++k) {
+		while (sn && !_nested(S[sn-1].p, S[sn-1].l, T[k].p, T[k].l)) {
+			sn -= 1;
+		}
+		const unsigned m = (sn ? S[sn-1].m : 0);
+		const int o = (T[k].m & TOUCH_READ(0) ? 1 : 0); // Other task
+		ov = (m & TOUCH_WRITE(o))
+			|| ((m & TOUCH_READ(o)) && (T[k].m & TOUCH_WRITE(1-o)));
+		S[sn] = T[k];
+		S[sn++].m |= m;
+	}
+	for (size_t k = 0; T && k < n; ++k) {
+		free(T[k].p);
+	}
+	free(T);
+	free(S);
+	return ov;
+}
+
+int task_queue_init(struct task_queue* const q) {
+	memset(q, 0, sizeof(struct task_queue));
+	q->max = TASKS_RUNNING;
+	int e = 0;
+	for (int k = 0; k < TASKS_MAX && !e; ++k) {
+		e = task_init(&q->t[k]);
+	}
+	return e;
+}
+
+void task_queue_end(struct task_queue* const q) {
+	for (int k = 0; k < TASKS_MAX; ++k) {
+		task_end(&q->t[k]);
 	}
-	else {
-		c = 1024 * 1024 * 16;
+	q->n = 0;
+}
+
+/*
+ * Returns free task, already at the end of queue, or NULL if full
+ * Caller has to task_new() it
+ */
+struct task* task_queue_add(struct task_queue* const q) {
+	if (q->n == TASKS_MAX) return NULL;
+	for (int k = 0; k < TASKS_MAX; ++k) {
+		int j = 0;
+		while (j < q->n && q->o[j] != k) j += 1;
+		if (j < q->n) continue;
+		q->o[q->n++] = k;
+		for (j = 0; j < TASKS_MAX; ++j) {
+			q->ov[k][j] = q->ov[j][k] = 0;
+		}
+		return &q->t[k];
 	}
-	if (t->tw.tws == AT_NOWHERE) {
-		t->err = tree_walk_start(&t->tw, t->src,
-			t->sources.arr[t->current_source]->str,
-			t->sources.arr[t->current_source]->len);
-		if (t->err) {
-			t->tw.tws = AT_NOWHERE;
-			return;
+	return NULL;
+}
+
+/*
+ * Removes finished (clean) tasks from queue
+ */
+void task_queue_drop(struct task_queue* const q) {
+	int n = 0;
+	for (int j = 0; j < q->n; ++j) {
+		const struct task* const t = &q->t[q->o[j]];
+		if (t->busy || t->ts != TS_CLEAN) {
+			q->o[n++] = q->o[j];
 		}
 	}
-	if (t->tf & TF_DEREF_LINKS) {
-		t->tw.tl = true;
+	q->n = n;
+}
+
+/*
+ * Moves j-th task in queue d places later (d < 0 = earlier)
+ */
+void task_queue_move(struct task_queue* const q, const int j, const int d) {
+	int to = j+d;
+	if (j < 0 || j >= q->n) return;
+	if (to < 0) to = 0;
+	if (to >= q->n) to = q->n-1;
+	const int k = q->o[j];
+	if (to > j) memmove(q->o+j, q->o+j+1, (to-j)*sizeof(int));
+	else memmove(q->o+to+1, q->o+to, (j-to)*sizeof(int));
+	q->o[to] = k;
+}
+
+/*
+ * Started and not paused; counts against max
+ * State of a busy task belongs to its worker; it is only paused
+ * after task_join(), so a busy started task is running
+ */
+static bool _running(const struct task* const t) {
+	return t->started
+		&& (t->busy || !(t->ts & (TS_CLEAN | TS_PAUSED | TS_QUEUED)));
+}
+
+/*
+ * Sources and destination of a task don't change,
+ * so overlap of two is found once, until either is replaced
+ */
+static bool _overlap(struct task_queue* const q, const int a, const int b) {
+	if (!q->ov[a][b]) {
+		q->ov[a][b] = q->ov[b][a] = 1 + task_overlap(&q->t[a], &q->t[b]);
 	}
-	while (t->tw.tws != AT_EXIT && !t->err && c > 0) {
-		ta(t, &c);
+	return q->ov[a][b] == 2;
+}
+
+static bool _may_run(struct task_queue* const q, const int j) {
+	const struct task* const t = &q->t[q->o[j]];
+	for (int k = 0; k < q->n; ++k) {
+		const struct task* const u = &q->t[q->o[k]];
+		if (k == j || (!u->busy && u->ts == TS_CLEAN)) continue;
+		if (_running(u) && u->dev[0] == t->dev[0] && u->dev[1] == t->dev[1]) {
+			return false;
+		}
+		if ((u->started || (k < j && !t->started))
+		&& _overlap(q, q->o[j], q->o[k])) {
+			return false;
+		}
 	}
-	if (t->err) {
-		t->ts = TS_FAILED;
+	return true;
+}
+
+/*
+ * Returns queued task that may run now, or NULL
+ * It is marked as started and moved to TS_RUNNING
+ */
+struct task* task_queue_next(struct task_queue* const q) {
+	int running = 0;
+	for (int j = 0; j < q->n; ++j) {
+		running += _running(&q->t[q->o[j]]);
 	}
-	else if (t->tw.tws == AT_EXIT) {
-		t->current_source += 1;
-		t->tw.tws = AT_NOWHERE;
-		if (t->current_source == t->sources.len) {
-			t->ts = onend;
-			tree_walk_end(&t->tw);
-			t->current_source = 0;
-		}
+	if (running >= q->max) return NULL;
+	for (int j = 0; j < q->n; ++j) {
+		struct task* const t = &q->t[q->o[j]];
+		if (t->busy || t->ts != TS_QUEUED || !_may_run(q, j)) continue;
+		t->started = true;
+		t->ts = TS_RUNNING;
+		return t;
 	}
+	return NULL;
 }
 
 static bool _files_opened(const struct task* const t) {
@@ -227,54 +2110,267 @@ static int _open_files(struct task* const t,
 	if (t->out == -1) {
 		return errno; // TODO TODO IMPORTANT
 	}
-	t->in = open(dst, O_WRONLY | O_CREAT, t->tw.cs.st_mode);
-	if (t->in == -1) {
+	/* Manifest said it's not there; make sure */
+	const int ex = (_mf_on(&t->tw, MF_REPLAY)
+		&& !(t->tw.fl & MF_CONFLICT) ? O_EXCL : 0);
+	struct stat outs;
+	int e = 0;
+	if (fstat(t->out, &outs)) e = errno;
+	/* Journal has to know of destination before it exists */
+	if (!e && !t->j.off) _jn_put(&t->j, 'c', src, &outs, 0);
+	clock_gettime(CLOCK_MONOTONIC, &t->j.at);
+	if (!e) e = _jn_flush(&t->j);
+	if (!e && (t->in = open(dst, O_WRONLY | O_CREAT | ex,
+			outs.st_mode)) == -1) {
+		e = errno;
+	}
+	if (e) {
 		close(t->out);
 		t->out = -1;
-		return errno;
+		return e;
 	}
-	struct stat outs;
-	if (fstat(t->out, &outs)) return errno;
+	t->isize = outs.st_size;
+#if defined(SEEK_DATA)
+	t->sparse = outs.st_blocks * 512 < outs.st_size;
+#else
+	t->sparse = false;
+#endif
+	t->dend = 0;
+	return 0;
+}
+
+static int _preallocate(struct task* const t) {
 #if HAS_FALLOCATE
-	if (outs.st_size > 0) {
-		int e = posix_fallocate(t->in, 0, outs.st_size);
+	if (t->isize > 0) {
+		int e = posix_fallocate(t->in, 0, t->isize);
 		// TODO detect earlier if fallocate is supported
 		if (e != EOPNOTSUPP && e != ENOSYS) return e;
 	}
+#else
+	(void)(t);
 #endif
 	return 0;
 }
 
+/*
+ * Errors that mean 'try another method'
+ */
+static bool _unsupported(const int e) {
+	return e == ENOSYS || e == EINVAL || e == EXDEV
+		|| e == EOPNOTSUPP || e == ENOTTY || e == EBADF;
+}
+
+/*
+ * Some filesystems (procfs, sysfs) report 0 from in-kernel copy
+ * instead of an error; it is only trusted at the end of file
+ */
+static bool _at_eof(const struct task* const t) {
+	return lseek(t->out, 0, SEEK_CUR) >= t->isize;
+}
+
+/*
+ * Reflinks whole file; returns true if it did
+ */
+static bool _clone(struct task* const t) {
+#if defined(__linux__)
+	if (!(t->cm & CM_CLONE)) return false;
+	if (!ioctl(t->in, FICLONE, t->out)) {
+		t->cms |= CM_CLONE;
+		return true;
+	}
+	/* Either filesystem can't do it, or files are on different ones;
+	 * files of a task usually are on the same two filesystems */
+	t->cm &= ~CM_CLONE;
+#else
+	(void)(t);
+#endif
+	return false;
+}
+
+/*
+ * Copies up to n bytes with the fastest method that works
+ * Returns number of bytes copied; 0 at the end of file; -1 on error
+ */
+static ssize_t _copy_chunk(struct task* const t, const size_t n) {
+	ssize_t r;
+	if (t->cp.use && !t->cp.on && _pipe_start(t)) {
+		t->cp.use = false;
+		t->cm &= ~CM_PIPE;
+	}
+	if (t->cp.use) {
+		if ((r = _pipe_write(t, n)) > 0) t->cms |= CM_PIPE;
+		return r;
+	}
+#if defined(__linux__) && defined(SYS_copy_file_range)
+	if (t->cm & CM_RANGE) {
+		r = syscall(SYS_copy_file_range, t->out, NULL, t->in, NULL, n, 0);
+		if (r > 0 || (!r && _at_eof(t))) {
+			t->cms |= CM_RANGE;
+			return r;
+		}
+		if (r == -1 && !_unsupported(errno)) return -1;
+		t->cm &= ~CM_RANGE;
+	}
+#endif
+#if defined(__linux__)
+	if (t->cm & CM_SENDFILE) {
+		r = sendfile(t->in, t->out, NULL, n);
+		if (r > 0 || (!r && _at_eof(t))) {
+			t->cms |= CM_SENDFILE;
+			return r;
+		}
+		if (r == -1 && !_unsupported(errno)) return -1;
+		t->cm &= ~CM_SENDFILE;
+	}
+#endif
+	if (!t->buf && !(t->buf = malloc(COPY_BUF_SIZE))) {
+		errno = ENOMEM;
+		return -1;
+	}
+	r = read(t->out, t->buf, (n < COPY_BUF_SIZE ? n : COPY_BUF_SIZE));
+	for (ssize_t w = 0, wb; w < r; w += wb) {
+		if ((wb = write(t->in, t->buf+w, r-w)) == -1) {
+			if (errno == EINTR) {
+				wb = 0;
+				continue;
+			}
+			return -1;
+		}
+	}
+	if (r > 0) t->cms |= CM_RW;
+	return r;
+}
+
+/*
+ * Pipeline overlaps reading and writing, which in-kernel copy
+ * can't do between different devices
+ */
+static bool _pipe_worth_it(const struct task* const t) {
+	struct stat ss, ds;
+	if (!(t->cm & CM_PIPE) || t->isize < PIPE_MIN_FILE
+	|| fstat(t->out, &ss) || fstat(t->in, &ds)) return false;
+	return ss.st_dev != ds.st_dev || !(t->cm & (CM_RANGE | CM_SENDFILE));
+}
+
+/*
+ * Moves both files to the next data extent of a sparse source;
+ * holes are skipped, so they stay holes in destination
+ * Returns number of bytes left in the extent,
+ * 0 if the rest of source is a hole, -1 on error
+ */
+static off_t _data_extent(struct task* const t) {
+#if defined(SEEK_DATA)
+	const off_t off = lseek(t->out, 0, SEEK_CUR);
+	if (off == -1) return -1;
+	if (off < t->dend) return t->dend - off;
+	off_t d = lseek(t->out, off, SEEK_DATA);
+	off_t h;
+	if (d == -1 && errno == ENXIO) {
+		d = h = t->isize;
+	}
+	else if (d == -1 && errno == EINVAL) { // Not supported
+		d = off;
+		h = t->isize;
+		t->sparse = false;
+	}
+	else if (d == -1 || (h = lseek(t->out, d, SEEK_HOLE)) == -1) {
+		return -1;
+	}
+	if (d > off) {
+		if (lseek(t->out, d, SEEK_SET) == -1
+		|| lseek(t->in, d, SEEK_SET) == -1) return -1;
+		t->size_done += d - off;
+	}
+	if (d >= t->isize) {
+		/* Trailing hole; there is nothing to write that
+		 * would extend destination */
+		return ftruncate(t->in, d) ? -1 : 0;
+	}
+	t->dend = h;
+	return h - d;
+#else
+	return t->isize;
+#endif
+}
+
+/*
+ * Records how far destination is on disk, every JOURNAL_MS
+ */
+static int _jn_offset(struct task* const t, const char* const src) {
+	struct journal* const j = &t->j;
+	if (!j->rw || _ns_since(&j->at) < JOURNAL_MS * 1000000ULL) {
+		return 0;
+	}
+	const off_t off = lseek(t->in, 0, SEEK_CUR);
+	if (off == -1 || fdatasync(t->in)) return errno;
+	_jn_put(j, 'o', src, NULL, off);
+	clock_gettime(CLOCK_MONOTONIC, &j->at);
+	return _jn_flush(j);
+}
+
 static int _copy(struct task* const t, const char* const src,
 		const char* const dst, int* const c) {
-	char buf[BUFSIZ];
 	// TODO if it fails at any point it should seek back
 	// to enable retrying
 	int e = 0;
-	if (!_files_opened(t) && (e = _open_files(t, dst, src))) {
-		return e;
+	struct timespec a;
+	if (!_files_opened(t)) {
+		if ((e = _open_files(t, dst, src))) return e;
+		/* Previous run got this far */
+		const off_t r = t->j.off;
+		t->j.off = 0;
+		if (r && (lseek(t->out, r, SEEK_SET) == -1
+		|| lseek(t->in, r, SEEK_SET) == -1)) {
+			e = errno;
+			_close_files(t);
+			return e;
+		}
+		t->size_done += r;
+		clock_gettime(CLOCK_MONOTONIC, &a);
+		const bool cloned = !r && _clone(t);
+		t->dns += _ns_since(&a);
+		t->calls += 1;
+		if (cloned) {
+			e = _jn_done(t, src);
+			_close_files(t);
+			if (e) return e;
+			t->size_done += t->isize;
+			*c -= t->isize;
+			t->files_done += 1;
+			return 0;
+		}
+		/* Preallocating would fill the holes */
+		if (!t->sparse && (e = _preallocate(t))) return e;
+		t->cp.use = !t->sparse && _pipe_worth_it(t);
 	}
-	ssize_t wb = -1, rb = -1;
 	while (*c > 0 && _files_opened(t)) {
-		rb = read(t->out, buf, sizeof(buf));
-		if (!rb) { // done copying
-			t->files_done += 1;
+		off_t x = *c;
+		if (t->sparse && (x = _data_extent(t)) != -1 && x > *c) {
+			x = *c;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &a);
+		const ssize_t n = (x > 0 ? _copy_chunk(t, x) : x);
+		t->dns += _ns_since(&a);
+		t->calls += 1;
+		if (!n) { // done copying
+			e = _jn_done(t, src);
 			_close_files(t);
-			return e;
+			if (e) return e;
+			t->files_done += 1;
+			return 0;
 		}
-		if (rb == -1) {
+		if (n == -1) {
 			e = errno;
 			_close_files(t);
 			return e;
 		}
-		wb = write(t->in, buf, rb);
-		if (wb == -1) {
-			e = errno;
+		t->size_done += n;
+		t->size_moved += n;
+		*c -= n;
+		if ((e = _jn_offset(t, src))) {
 			_close_files(t);
 			return e;
 		}
-		t->size_done += wb;
-		*c -= wb;
 	}
 	return 0;
 }
@@ -335,8 +2431,22 @@ int tree_walk_start(struct tree_walk* const tw,
 	pushd(tw->path, &tw->pathlen, file, file_len);
 	tw->tl = false;
 	if (tw->dt) free(tw->dt);
+	tw->dt = NULL;
+	if (_mf_on(tw, MF_REPLAY)) {
+		struct manifest* const m = tw->m;
+		while (m->pos < m->len && !(_mf_rec(m, m->pos)->fl & MF_TOP)) {
+			m->pos += _mf_rec(m, m->pos)->len;
+		}
+		tw->depth = 0;
+		_mf_next(tw);
+		return 0;
+	}
 	tw->dt = calloc(1, sizeof(struct dirtree));
-	return _stat_file(tw);
+	const int e = _stat_file(tw);
+	tw->dt->dev = tw->cs.st_dev;
+	if (e && _mf_on(tw, MF_RECORD)) _mf_drop(tw->m);
+	else if (_mf_on(tw, MF_RECORD)) _mf_put(tw, file, file_len, MF_TOP);
+	return e;
 }
 
 void tree_walk_end(struct tree_walk* const tw) {
@@ -350,13 +2460,65 @@ void tree_walk_end(struct tree_walk* const tw) {
 	memset(tw, 0, sizeof(struct tree_walk));
 }
 
-//TODO: void tree_walk_skip(struct tree_walk* const tw) {}
+/*
+ * Next step goes past directory tw is at, instead of into it
+ */
+void tree_walk_skip(struct tree_walk* const tw) {
+	if (tw->tws != AT_DIR) return;
+	if (_mf_on(tw, MF_REPLAY)) {
+		struct manifest* const m = tw->m;
+		int d = 0;
+		while (m->pos < m->len && d >= 0) {
+			const struct mf_rec* const r = _mf_rec(m, m->pos);
+			if (r->tws == AT_DIR) d += 1;
+			else if (r->tws == AT_DIR_END) d -= 1;
+			m->pos += r->len;
+		}
+	}
+	tw->tws = AT_SPECIAL;
+}
 
-int tree_walk_step(struct tree_walk* const tw) {
+/*
+ * Same steps as tree_walk_step() takes, read from manifest
+ */
+static int _replay_step(struct tree_walk* const tw) {
+	switch (tw->tws) {
+	case AT_LINK:
+	case AT_FILE:
+	case AT_SPECIAL:
+		if (!tw->depth) {
+			tw->tws = AT_EXIT;
+			return 0;
+		}
+		popd(tw->path, &tw->pathlen);
+		break;
+	case AT_DIR:
+		tw->depth += 1;
+		break;
+	case AT_DIR_END:
+		tw->depth -= 1;
+		popd(tw->path, &tw->pathlen);
+		break;
+	default:
+		break;
+	}
+	if (!tw->depth) {
+		tw->tws = AT_EXIT;
+		return 0;
+	}
+	_mf_next(tw);
+	if (tw->tws & (AT_EXIT | AT_DIR_END)) return 0;
+	const char* const n = _mf_name(_mf_rec(tw->m, tw->m->last));
+	pushd(tw->path, &tw->pathlen, n, strnlen(n, NAME_MAX_LEN));
+	return 0;
+}
+
+static int _walk_step(struct tree_walk* const tw) {
 	struct dirtree *new_dt, *up;
 	switch (tw->tws)  {
 	case AT_LINK:
 	case AT_FILE:
+	case AT_SPECIAL:
 		if (!tw->dt->cd) {
 			tw->tws = AT_EXIT;
 			return 0;
@@ -374,6 +2536,7 @@ int tree_walk_step(struct tree_walk* const tw) {
 			free(new_dt);
 			return errno;
 		}
+		new_dt->dev = tw->cs.st_dev;
 		break;
 	case AT_DIR_END:
 		/* Go back */
@@ -402,14 +2565,275 @@ int tree_walk_step(struct tree_walk* const tw) {
 	// TODO errno
 	if (!ce) {
 		tw->tws = AT_DIR_END;
+		if (!errno && _mf_on(tw, MF_RECORD)) _mf_put(tw, NULL, 0, 0);
 		return errno;
 	}
 	const size_t nl = strnlen(ce->d_name, NAME_MAX_LEN);
 	pushd(tw->path, &tw->pathlen, ce->d_name, nl);
-	return _stat_file(tw);
+	const int e = _stat_file(tw);
+	if (!e && _mf_on(tw, MF_RECORD)) _mf_put(tw, ce->d_name, nl, 0);
+	return e;
+}
+
+int tree_walk_step(struct tree_walk* const tw) {
+	if (_mf_on(tw, MF_REPLAY)) return _replay_step(tw);
+	const int e = _walk_step(tw);
+	if (e && _mf_on(tw, MF_RECORD)) _mf_drop(tw->m);
+	return e;
+}
+
+/*
+ * Small files of a copy without conflicts can be batched:
+ * there is nothing to ask about and O_EXCL catches races
+ */
+static bool _batchable(struct task* const t) {
+	if (t->t != TASK_COPY || t->tw.tws != AT_FILE || t->conflicts
+	|| t->j.off || !(t->cm & CM_URING) || (t->cm & CM_CLONE)
+	|| !S_ISREG(t->tw.cs.st_mode)
+	|| t->tw.cs.st_size >= URING_FILE_MAX) {
+		return false;
+	}
+	if (t->ub) return !t->ub->sync;
+	struct uring_batch* const b = calloc(1, sizeof(struct uring_batch));
+	if (b) {
+		b->j = malloc(URING_QD * sizeof(struct small_copy));
+		b->buf = malloc(URING_QD * URING_FILE_MAX);
+	}
+	if (!b || !b->j || !b->buf || uring_init(&b->u, 2*URING_QD)) {
+		if (b) {
+			free(b->j);
+			free(b->buf);
+		}
+		free(b);
+		t->cm &= ~CM_URING;
+		return false;
+	}
+	t->ub = b;
+	return true;
+}
+
+/*
+ * Submits what was prepared and collects results into j[].r
+ */
+static int _round(struct uring_batch* const b) {
+	unsigned n;
+	int e = uring_submit(&b->u, &n);
+	uint64_t d;
+	int r;
+	while (n && !e) {
+		if ((e = uring_wait(&b->u, &d, &r))) break;
+		b->j[d].r = r;
+		n -= 1;
+	}
+	return e;
+}
+
+/*
+ * Creates and writes destination directly:
+ * io_uring would hand O_CREAT (and writes that allocate blocks)
+ * to its worker threads, which costs more than the syscalls
+ * Returns true if it's all there
+ */
+static bool _put(const struct small_copy* const j, const char* const buf) {
+	const int fd = open(j->dst, O_WRONLY | O_CREAT | O_EXCL,
+			j->cs.st_mode & 07777);
+	if (fd == -1) return false;
+	bool ok = write(fd, buf, j->cs.st_size) == j->cs.st_size;
+	ok = !close(fd) && ok;
+	if (!ok) unlink(j->dst);
+	return ok;
+}
+
+/*
+ * Opens all queued sources at once, reads them all at once
+ * and closes them all at once; with cold caches they wait
+ * for the disk together instead of one by one.
+ * Reads one byte more than expected to notice files that grew.
+ * Jobs that failed are left for _flush() to retry.
+ */
+static void _batch(struct task* const t) {
+	struct uring_batch* const b = t->ub;
+	struct uring* const u = &b->u;
+	struct small_copy* j;
+	size_t k;
+	for (k = 0, j = b->j; k < b->n; ++k, ++j) {
+		j->r = -ECANCELED;
+		uring_openat(u, j->src, O_RDONLY, 0, k);
+	}
+	int e = _round(b);
+	for (k = 0, j = b->j; k < b->n; ++k, ++j) {
+		j->sfd = (j->r >= 0 ? j->r : -1);
+		j->retry = e || j->sfd == -1;
+		j->r = -ECANCELED;
+		if (j->retry) continue;
+		uring_read(u, j->sfd, b->buf + k*URING_FILE_MAX,
+			j->cs.st_size+1, k);
+	}
+	e = e ? e : _round(b);
+	for (k = 0, j = b->j; k < b->n; ++k, ++j) {
+		if (!j->retry) {
+			j->retry = e || j->r != j->cs.st_size
+				|| !_put(j, b->buf + k*URING_FILE_MAX);
+		}
+		if (j->sfd != -1 && !e) uring_close(u, j->sfd, k);
+		else if (j->sfd != -1) close(j->sfd);
+	}
+	e = e ? e : _round(b);
+	/* One sync of destination's filesystem for the whole batch,
+	 * before journal says any of it is done */
+	bool done = false;
+	for (k = 0; !done && k < b->n; ++k) done = !b->j[k].retry;
+	const bool synced = t->j.rw && done && !_syncfs(t->j.fd);
+	size_t m = 0;
+	for (k = 0, j = b->j; k < b->n; ++k, ++j) {
+		if (j->retry) {
+			b->j[m++] = *j;
+			continue;
+		}
+		t->size_done += j->cs.st_size;
+		t->size_moved += j->cs.st_size;
+		t->files_done += 1;
+		t->cms |= CM_URING;
+		if (synced) _jn_put(&t->j, 'd', j->src, NULL, 0);
+	}
+	b->n = m;
+	if (e) t->cm &= ~CM_URING;
+}
+
+static int _copyremove_step(struct task* const, int* const);
+
+/*
+ * Runs job through regular path as if tree walk was at it
+ */
+static int _sync_copy(struct task* const t, struct small_copy* const j) {
+	const struct tree_walk tw = t->tw;
+	int e, c = INT_MAX;
+	t->tw.path = j->src;
+	t->tw.pathlen = strnlen(j->src, PATH_MAX_LEN);
+	t->tw.cs = j->cs;
+	t->tw.tws = AT_FILE;
+	t->tw.m = NULL;
+	t->ub->sync = true;
+	do {
+		e = _copyremove_step(t, &c);
+	} while (!e && _files_opened(t));
+	t->ub->sync = false;
+	t->tw = tw;
+	return e;
+}
+
+/*
+ * Copies queued files; those that batch couldn't copy
+ * go through regular path one by one,
+ * which handles conflicts and reports errors (with t->ep)
+ * Failed job stays first in queue until it is copied or skipped.
+ */
+static int _flush(struct task* const t) {
+	struct uring_batch* const b = t->ub;
+	int e = 0;
+	t->ep = NULL;
+	if (b->n && !b->j[0].retry && (e = _jn_flush(&t->j))) return e;
+	if (b->n && !b->j[0].retry) {
+		struct timespec a;
+		clock_gettime(CLOCK_MONOTONIC, &a);
+		_batch(t);
+		t->dns += _ns_since(&a);
+		t->calls += 3; // Opens, reads, closes
+	}
+	size_t k = 0;
+	while (k < b->n && !(e = _sync_copy(t, &b->j[k]))) k += 1;
+	memmove(b->j, b->j+k, (b->n-k) * sizeof(struct small_copy));
+	b->n -= k;
+	if (e) t->ep = b->j[0].src;
+	return e;
+}
+
+static int _enqueue(struct task* const t, const char* const np,
+		int* const c) {
+	struct uring_batch* const b = t->ub;
+	int e;
+	if (b->n == URING_QD && (e = _flush(t))) return e;
+	struct small_copy* const j = &b->j[b->n++];
+	strcpy(j->src, t->tw.path);
+	strcpy(j->dst, np);
+	j->cs = t->tw.cs;
+	j->retry = false;
+	_jn_put(&t->j, 'c', j->src, &j->cs, 0);
+	*c -= j->cs.st_size;
+	return 0;
+}
+
+/*
+ * Skips file that failed; either one from batch or current one
+ */
+int task_skip(struct task* const t) {
+	if (t->ep) {
+		struct uring_batch* const b = t->ub;
+		b->n -= 1;
+		memmove(b->j, b->j+1, b->n * sizeof(struct small_copy));
+		t->ep = NULL;
+		return 0;
+	}
+	return tree_walk_step(&t->tw);
+}
+
+/*
+ * Entry tw is at is on destination's filesystem
+ * and there's no mount point inside it
+ */
+static bool _renamable(const struct task* const t) {
+	const struct move_plan* const p = &t->mv;
+	const struct tree_walk* const tw = &t->tw;
+	if (!p->dev || tw->tws == AT_DIR_END) return false;
+	dev_t dev = p->dev[t->current_source];
+	size_t in = 0; // Longest mount point entry is in
+	for (size_t k = 0; k < p->nmp; ++k) {
+		const char* const m = p->mp[k].path;
+		const size_t ml = strnlen(m, PATH_MAX_LEN);
+		const size_t l = (ml < tw->pathlen ? ml : tw->pathlen);
+		if (memcmp(m, tw->path, l)) continue;
+		if (ml > tw->pathlen && m[l] == '/') return false;
+		if (ml <= tw->pathlen && ml > in
+		&& (ml == tw->pathlen || tw->path[ml] == '/')) {
+			in = ml;
+			dev = p->mp[k].dev;
+		}
+	}
+	return dev == p->ddev;
+}
+
+/*
+ * Entry is in journal, so destination is previous run's work.
+ * If source didn't change since (size and mtime), done file is skipped
+ * and unfinished one continues from what was on disk;
+ * otherwise it's copied again.
+ * Returns true if there's nothing left to copy
+ */
+static bool _resume(struct task* const t,
+		const struct journal_entry* const je, const char* const np) {
+	struct stat d;
+	t->j.off = 0;
+	if (je->st == JE_MADE || !(t->tw.tws & (AT_FILE | AT_LINK))
+	|| lstat(np, &d)) {
+		return false;
+	}
+	const bool same = t->tw.cs.st_size == je->size
+		&& _same_time(&t->tw.cs.st_mtim, &je->mtime);
+	if (same && je->st == JE_DONE
+	&& (S_ISLNK(d.st_mode) || d.st_size == je->size)) {
+		t->size_done += je->size;
+		t->files_done += 1;
+		return true;
+	}
+	if (same && je->off && S_ISREG(d.st_mode) && d.st_size >= je->off) {
+		t->j.off = je->off;
+		return false;
+	}
+	unlink(np);
+	return false;
 }
 
-inline static int _copyremove_step(struct task* const t, int* const c) {
+static int _copyremove(struct task* const t, int* const c) {
 	// TODO absolute mess; simplify
 	// TODO skipped counter
 	char np[PATH_BUF_SIZE];
@@ -418,17 +2842,24 @@ inline static int _copyremove_step(struct task* const t, int* const c) {
 	const bool ov = t->tf & TF_OVERWRITE_CONFLICTS;
 	int err = 0;
 
-	/* QUICK MOVE */
-	if ((t->t & TASK_MOVE) && same_fs(t->src, t->dst)) {
-		task_build_path(t, np);
-		if (rename(t->tw.path, np)) {
-			return errno;
+	/* QUICK MOVE
+	 * Conflicts go the long way, which knows what to do with them */
+	if ((t->t & TASK_MOVE) && _renamable(t) && !task_build_path(t, np)
+	&& (!t->conflicts || access(np, F_OK))) {
+		if (!rename(t->tw.path, np)) {
+			if (t->tw.tws == AT_DIR) {
+				tree_walk_skip(&t->tw);
+				t->mv.skipped = true;
+				return 0;
+			}
+			t->size_done += t->tw.cs.st_size;
+			t->files_done += 1;
+			return 0;
 		}
-		t->tw.tws = AT_EXIT;
-		t->size_done = t->size_total;
-		t->files_done = t->files_total;
-		t->dirs_done = t->dirs_total;
-		return 0;
+		/* Bind mounts of the same filesystem can't rename
+		 * between each other; rest of source is copied */
+		if (errno != EXDEV && errno != EBUSY) return errno;
+		t->mv.dev[t->current_source] = t->mv.ddev + 1; // Not ddev
 	}
 
 	/* SKIP LINKS FLAG */
@@ -436,12 +2867,31 @@ inline static int _copyremove_step(struct task* const t, int* const c) {
 		return 0;
 	}
 
+	/* RESUMING
+	 * What previous run made is no conflict */
+	const struct journal_entry* const je = (cp && !_files_opened(t)
+		? _jn_find(&t->j, t->tw.path, t->tw.pathlen) : NULL);
+	bool done = false;
+	if (je) {
+		task_build_path(t, np);
+		done = _resume(t, je, np);
+	}
+
 	/* COPYING */
-	if (cp) {
+	if (cp && !done) {
 		task_build_path(t, np);
 
-		/* IF DESTINATION EXISTS */
-		if (!access(np, F_OK)) {
+		/* SMALL FILES GO IN BATCHES */
+		if (_batchable(t)) {
+			return _enqueue(t, np, c);
+		}
+
+		/* IF DESTINATION EXISTS
+		 * Fresh manifest knows; creating fails if it's wrong.
+		 * Unfinished file is the one being copied */
+		if (!je && !_files_opened(t)
+		&& (!_mf_on(&t->tw, MF_REPLAY) || (t->tw.fl & MF_CONFLICT))
+		&& !access(np, F_OK)) {
 			if (t->tf & TF_SKIP_CONFLICTS) return 0;
 			if (ov || (t->tf & TF_OVERWRITE_ONCE)) {
 				t->tf &= ~TF_OVERWRITE_ONCE;
@@ -465,6 +2915,8 @@ inline static int _copyremove_step(struct task* const t, int* const c) {
 			}
 			break;
 		case AT_LINK:
+			_jn_put(&t->j, 'c', t->tw.path, &t->tw.cs, 0);
+			if ((err = _jn_flush(&t->j))) return err;
 			if (t->tf & TF_RAW_LINKS) {
 				err = link_copy_raw(t->tw.path, np);
 			}
@@ -475,15 +2927,18 @@ inline static int _copyremove_step(struct task* const t, int* const c) {
 			if (err) return err;
 			t->size_done += t->tw.cs.st_size;
 			t->files_done += 1;
+			_jn_done(t, t->tw.path);
 			break;
 		case AT_DIR:
+			_jn_put(&t->j, 'm', t->tw.path, NULL, 0);
+			if ((err = _jn_flush(&t->j))) return err;
 			if (mkdir(np, t->tw.cs.st_mode)) {
 				/* TODO
 				 * One cannot remove non-empty directory
 				 * to prevent EEXIST error on overwrite flag
 				 */
 				err = errno;
-				if (ov && err == EEXIST) {
+				if ((ov || je) && err == EEXIST) {
 					err = 0;
 				}
 			}
@@ -511,15 +2966,33 @@ inline static int _copyremove_step(struct task* const t, int* const c) {
 			if (rmdir(t->tw.path)) {
 				return errno;
 			}
-			t->size_done += t->tw.cs.st_size;
-			t->dirs_done += 1;
-			*c -= t->tw.cs.st_size;
+			if (!cp) { // Counted when made
+				t->size_done += t->tw.cs.st_size;
+				t->dirs_done += 1;
+				*c -= t->tw.cs.st_size;
+			}
 		}
 	}
 	return 0;
 }
 
+static int _copyremove_step(struct task* const t, int* const c) {
+	const int e = _copyremove(t, c);
+	if (e == EEXIST && _mf_on(&t->tw, MF_REPLAY)
+	&& !(t->tw.fl & MF_CONFLICT)) {
+		/* Appeared after estimate */
+		t->tw.fl |= MF_CONFLICT;
+		return _copyremove(t, c);
+	}
+	return e;
+}
+
 void task_action_copyremove(struct task* const t, int* const c) {
+	if (_queued(t) && (t->ep || t->tw.tws == AT_EXIT)) {
+		t->err = _flush(t);
+		return;
+	}
+	*c -= 4096; // Empty files take time too
 	if ((t->err = _copyremove_step(t, c))
 	|| (_files_opened(t))
 	|| (t->err = tree_walk_step(&t->tw))) {
@@ -32,9 +32,24 @@
 
 #include <stdint.h>
 #include <time.h>
+#include <pthread.h>
+
+#if defined(__linux__)
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <sys/sendfile.h>
+	#ifndef FICLONE
+		#define FICLONE _IOW(0x94, 9, int)
+	#endif
+	#ifndef SEEK_DATA // glibc hides them without _GNU_SOURCE
+		#define SEEK_DATA 3
+		#define SEEK_HOLE 4
+	#endif
+#endif
 
 #include "fs.h"
 #include "utf8.h"
+#include "uring.h"
 
 typedef unsigned long long xtime_ms_t;
 
@@ -66,6 +81,80 @@ enum tree_walk_state {
 struct dirtree {
 	struct dirtree* up; // ..
 	DIR* cd; // Current Directory
+	dev_t dev; // Of current directory
+};
+
+/*
+ * Estimate records every step of its tree walk,
+ * so that the task doesn't have to read the same trees again.
+ * If no directory it saw changed since (ctime),
+ * tree_walk replays records instead of calling readdir() and lstat()
+ */
+enum manifest_state {
+	MF_OFF = 0,
+	MF_RECORD, // Estimate appends records
+	MF_READY, // Estimate finished; not checked yet
+	MF_REPLAY, // Fresh; tree_walk reads records
+};
+
+enum manifest_flags {
+	MF_TOP = 1<<0, // First record of a source
+	MF_CONFLICT = 1<<1, // Destination existed
+	MF_TIMES = 1<<2, // Directory; ctimes of source and destination follow
+};
+
+#define MANIFEST_MAX (64*1024*1024)
+
+struct manifest {
+	enum manifest_state s;
+	char* b; // Records; each starts at multiple of 8
+	size_t len, cap;
+	size_t pos; // Next record to replay
+	size_t last; // Record of current entry
+	struct timespec top[2]; // ctimes of src and dst
+};
+
+/*
+ * Copy may keep a journal in destination directory,
+ * named after its source, destination and sources,
+ * so that the same copy started again skips what was done.
+ * Records end with NUL; PATH is relative to source directory:
+ *   c SIZE SEC NSEC PATH  copying started; size and mtime of source
+ *   o OFF PATH            destination is on disk up to OFF
+ *   d PATH                file or link done
+ *   m PATH                directory made
+ * Offset is recorded every JOURNAL_MS, and done when it's finished,
+ * both after fdatasync() of destination.
+ * Estimate only reads journal; it's created when the task runs.
+ */
+#define JOURNAL_NAME ".hund-journal-%016llx"
+#define JOURNAL_MS 2000
+
+enum journal_entry_state {
+	JE_STARTED,
+	JE_DONE,
+	JE_MADE,
+};
+
+struct journal_entry {
+	const char* path; // Points into journal's b
+	off_t size, off;
+	struct timespec mtime;
+	enum journal_entry_state st;
+};
+
+struct journal {
+	int fd; // -1 = no journal
+	bool rw; // fd appends; otherwise journal is only read
+	char* path; // NULL = not looked for yet
+	size_t pl; // Length of source directory prefix of walked paths
+	char* b; // Journal left by previous run
+	struct journal_entry* e; // What it says; sorted by path
+	size_t n;
+	char* w; // Records not written yet
+	size_t wl, wcap;
+	struct timespec at; // Last offset record
+	off_t off; // Current file continues from; 0 = from start
 };
 
 /*
@@ -82,6 +171,10 @@ struct tree_walk {
 	struct stat cs; // Current Stat
 	char* path;
 	size_t pathlen;
+
+	struct manifest* m; // Records steps or replays them; NULL = neither
+	int depth; // Of replay
+	unsigned fl; // Manifest flags of current entry
 };
 
 enum task_flags {
@@ -94,26 +187,168 @@ enum task_flags {
 	TF_SKIP_LINKS = 1<<6,
 	TF_RECURSIVE_CHMOD = 1<<7,
 	TF_RECALCULATE_LINKS = 1<<8,
+	TF_NOCACHE = 1<<9, // Drop copied data from page cache
+	TF_JOURNAL = 1<<10, // Keep struct journal; resume from it
 	TF_ANY_LINK_METHOD = (TF_RAW_LINKS | TF_DEREF_LINKS
 		| TF_SKIP_LINKS | TF_RECALCULATE_LINKS),
 };
 
+/*
+ * Ways of copying file contents, from the fastest
+ * Task starts with all available and drops those
+ * that the filesystems turn out not to support
+ */
+enum copy_method {
+	CM_CLONE = 1<<0, // FICLONE; shares extents (btrfs, xfs)
+	CM_RANGE = 1<<1, // copy_file_range(); in kernel
+	CM_SENDFILE = 1<<2, // sendfile(); in kernel
+	CM_RW = 1<<3, // read()/write() with COPY_BUF_SIZE buffer
+	CM_PIPE = 1<<4, // struct copy_pipe; tried before CM_RANGE
+	CM_URING = 1<<5, // Small files in batches through io_uring
+};
+
+static const char* const copy_method_names[] = {
+	"reflink", "copy_file_range", "sendfile", "read/write",
+	"pipeline", "io_uring", NULL,
+};
+
+#define COPY_BUF_SIZE (1024*1024)
+
+/*
+ * Reader thread and writer (worker) connected by a ring of buffers
+ * Used for big files between different devices,
+ * so that neither device idles while the other one works,
+ * and when in-kernel copy is not available.
+ * Block size and number of blocks in flight adapt to devices.
+ */
+#define PIPE_SLOTS 8
+#define PIPE_BLOCK_MIN (128*1024)
+#define PIPE_BLOCK_MAX (4*1024*1024)
+#define PIPE_MIN_FILE (8*1024*1024)
+
+struct copy_pipe {
+	pthread_t th;
+	pthread_mutex_t mx;
+	pthread_cond_t cv;
+	bool use; // Current file goes through pipeline
+	bool on; // Reader thread runs
+	bool stop, eof;
+	int err; // Reader's errno
+	char* b[PIPE_SLOTS]; // Page aligned, PIPE_BLOCK_MAX each
+	size_t len[PIPE_SLOTS];
+	unsigned long long rd, wr; // Blocks read, blocks written
+	unsigned depth; // Blocks reader may read ahead
+	size_t bs; // Block size reader asks for
+	unsigned rstalls, wstalls; // Since last depth adjustment
+	off_t off; // Written so far
+	off_t doff; // Destination range waiting to be dropped from cache
+	size_t dlen;
+	struct timespec start;
+	unsigned long long rns, wns, ns; // Reading, writing, total time
+};
+
 enum task_state {
 	TS_CLEAN = 0,
 	TS_ESTIMATE = 1<<0, // after task_new; runs task_estimate
 	TS_CONFIRM = 1<<1, // after task_estimate is finished; task configuration
 	TS_RUNNING = 1<<2, // task runs
-	TS_PAUSED = 1<<3,
+	TS_PAUSED = 1<<3, // by TM_PAUSE; task_resume() returns to state before
 	TS_FAILED = 1<<4, // if something went wrong. on some errors task can retry
-	TS_FINISHED = 1<<5 // task succesfully finished; cleans up, returns to TS_CLEAN
+	TS_FINISHED = 1<<5, // task succesfully finished; cleans up, returns to TS_CLEAN
+	TS_QUEUED = 1<<6, // confirmed; waits for task_queue_next()
 };
 
+/*
+ * Copying a tiny file takes about ten syscalls,
+ * most of them waiting for the previous one.
+ * Files smaller than URING_FILE_MAX are queued instead
+ * and up to URING_QD of them are copied together:
+ * their sources are opened, read and closed in batches.
+ */
+#define URING_QD 64
+#define URING_FILE_MAX (64*1024)
+
+struct uring_batch;
+
+/*
+ * Estimate of directories is split between WALKERS threads.
+ * Listing one directory is a unit of work; each walker keeps
+ * subdirectories it finds in its own deque and takes the newest,
+ * idle walkers steal the oldest (biggest, most likely) from others.
+ * Counts are summed as units finish.
+ */
+#define WALKERS 4
+
+struct walk_pool;
+
+/*
+ * Volume of directories is measured the same way in background,
+ * every subdirectory being a unit, but nothing is recorded; only sums.
+ * Inodes with more links are counted once in each directory.
+ */
+struct volume_pool;
+
+/*
+ * Move is planned once, when it starts: devices of destination
+ * and of each source, and mount points that estimate found inside them.
+ * Whatever is on destination's filesystem and has no mount point
+ * inside is renamed at once. The rest is copied and removed
+ * entry by entry, so that sources go as soon as they are copied.
+ */
+struct mount_point {
+	char* path;
+	dev_t dev;
+};
+
+struct move_plan {
+	bool planned;
+	dev_t ddev; // Destination
+	dev_t* dev; // Of each source; NULL = nothing is renamed
+	struct mount_point* mp; // Directories on other device than parent
+	size_t nmp;
+	bool skipped; // Renamed directories weren't counted
+};
+
+struct task;
+typedef void (*task_action)(struct task* const, int* const);
+
+/*
+ * Requests from UI to the worker
+ */
+enum task_msg {
+	TM_NONE = 0,
+	TM_PAUSE,
+	TM_ABORT,
+};
+
+/*
+ * Counters published by the worker after each chunk of work
+ */
+struct task_progress {
+	ssize_t size_total, size_done, size_moved;
+	fnum_t files_total, files_done;
+	fnum_t dirs_total, dirs_done;
+	int rbusy, wbusy; // Pipeline reader/writer utilization in %; -1 if unused
+	double bps, fps; // Bytes and files per second; moving averages
+	long eta; // Seconds left; -1 if unknown
+	unsigned long long ms[2]; // Spent estimating, running
+	unsigned long long data_ms; // Part of running spent moving file data
+	unsigned long long calls; // Calls that moved file data
+};
+
+/*
+ * Rates are sampled at most every RATE_MS
+ * and averaged over about RATE_AVG_MS
+ */
+#define RATE_MS 500
+#define RATE_AVG_MS 5000
+
 struct task {
 	enum task_type t;
 	enum task_state ts;
 	enum task_flags tf;
 
-	//    vvv basically pointers to panel->wd; to not free
+	// Copies of panel->wd; panels may change while task runs
 	char* src; // Source directory path
 	char* dst; // Destination directory path
 	struct string_list sources; // Files to be copied
@@ -124,16 +359,75 @@ struct task {
 
 	int err; // Last errno
 	struct tree_walk tw;
-	int in, out;
+	int in, out; // Destination, source
+	off_t isize; // Size of source at the time it was opened
+	bool sparse; // Source has holes; only data extents are copied
+	off_t dend; // End of current data extent
+	enum copy_method cm; // Methods still worth trying
+	enum copy_method cms; // Methods that actually copied something
+	char* buf; // For CM_RW
+	struct copy_pipe cp;
+	struct uring_batch* ub; // Queued small files
+	char* ep; // Path of failed file if it is not tw.path
+	struct manifest mf;
+	struct journal j;
+	struct move_plan mv;
+	struct walk_pool* wp; // Walkers of estimate
+	bool seq; // Estimate walks alone
 
 	fnum_t conflicts, symlinks, specials;
 	ssize_t size_total, size_done;
+	ssize_t size_moved; // File data actually copied; no holes, no reflinks
 	fnum_t files_total, files_done;
 	fnum_t dirs_total, dirs_done;
 
+	unsigned long long ns[2]; // Spent estimating, running
+	unsigned long long dns; // Moving file data
+	unsigned long long calls; // That moved file data
+	struct timespec rat; // Last rate sample
+	ssize_t rsize; // size_done at last sample
+	fnum_t rfiles; // files_done at last sample
+
 	mode_t chp, chm;
 	uid_t cho;
 	gid_t chg;
+
+	bool started; // Was let run by queue; holds its files until finished
+	enum task_state resume; // What TS_PAUSED returns to
+	dev_t dev[2]; // Devices of src and dst
+
+	/*
+	 * Worker thread
+	 * While it runs (busy), everything above belongs to it;
+	 * UI may only use msg and p, under mx
+	 */
+	pthread_t th;
+	pthread_mutex_t mx;
+	bool busy;
+	enum task_msg msg;
+	struct task_progress p;
+	int wfd[2]; // One byte is written to wfd[1] when worker stops
+	task_action ta;
+	enum task_state onend;
+};
+
+/*
+ * Tasks are queued in order in which they will run.
+ * Each has its own worker; estimates start right away,
+ * but confirmed tasks wait (TS_QUEUED) until fewer than max run
+ * and no other running task reads from and writes to the same devices.
+ * Task that touches files written by a task before it
+ * (or written by a task that already started) waits for it to finish.
+ */
+#define TASKS_MAX 8
+#define TASKS_RUNNING 4
+
+struct task_queue {
+	struct task t[TASKS_MAX];
+	int o[TASKS_MAX]; // Order; indices of t
+	int n; // Tasks in queue
+	int max; // Tasks running at once
+	unsigned char ov[TASKS_MAX][TASKS_MAX]; // 0 = not known, 1 = apart, 2 = overlap
 };
 
 void task_new(struct task* const, const enum task_type,
@@ -144,15 +438,39 @@ void task_new(struct task* const, const enum task_type,
 void task_clean(struct task* const);
 int task_build_path(const struct task* const, char*);
 
-typedef void (*task_action)(struct task* const, int* const);
 void task_action_chmod(struct task* const, int* const);
 void task_action_estimate(struct task* const, int* const);
 void task_action_copyremove(struct task* const, int* const);
 void task_do(struct task* const, task_action, const enum task_state);
+int task_skip(struct task* const);
+
+int task_init(struct task* const);
+void task_end(struct task* const);
+int task_start(struct task* const, task_action, const enum task_state);
+void task_join(struct task* const);
+void task_message(struct task* const, const enum task_msg);
+void task_resume(struct task* const);
+void task_get_progress(struct task* const, struct task_progress* const);
+
+bool task_overlap(const struct task* const, const struct task* const);
+int task_queue_init(struct task_queue* const);
+void task_queue_end(struct task_queue* const);
+struct task* task_queue_add(struct task_queue* const);
+void task_queue_drop(struct task_queue* const);
+void task_queue_move(struct task_queue* const, const int, const int);
+struct task* task_queue_next(struct task_queue* const);
 
 int tree_walk_start(struct tree_walk* const, const char* const,
 		const char* const, const size_t);
 void tree_walk_end(struct tree_walk* const);
 int tree_walk_step(struct tree_walk* const);
+void tree_walk_skip(struct tree_walk* const);
+
+int volume_start(struct volume_pool** const, const char* const,
+		const struct string_list* const);
+fnum_t volume_take(struct volume_pool* const,
+		struct dir_volume* const, const fnum_t);
+bool volume_finished(const struct volume_pool* const);
+void volume_end(struct volume_pool** const);
 
 #endif
@@ -19,81 +19,258 @@
 
 #include "terminal.h"
 
-ssize_t xread(int fd, void* buf, ssize_t count, int timeout_us) {
-	struct timespec T = { 0, (suseconds_t)timeout_us*1000 };
-	fd_set rfds;
-	int retval;
-	if (timeout_us > 0) {
-		FD_ZERO(&rfds);
-		FD_SET(fd, &rfds);
+/*
+ * Frame that did not fit into terminal's output buffer
+ * Depth of the queue is one: newer frames
+ * are not sent until this one drains.
+ */
+static struct append_buffer pending;
+
+/*
+ * Called by the event loop when stdout is writable
+ * Wakes the loop up when pending frame has been sent,
+ * so that the caller can draw a newer one
+ */
+static bool _drain(int fd, short ev, void* data) {
+	(void)(fd);
+	(void)(ev);
+	(void)(data);
+	return !output_drain();
+}
+
+/*
+ * Sends frame; what was not accepted by the terminal
+ * is kept and sent by output_drain()
+ * Returns number of bytes written or -1
+ */
+ssize_t output_frame(const struct iovec* const iov, const int n) {
+	ssize_t w = writev(STDOUT_FILENO, iov, n);
+	size_t s = (w > 0 ? (size_t)w : 0);
+	for (int v = 0; v < n; ++v) {
+		if (s >= iov[v].iov_len) {
+			s -= iov[v].iov_len;
+			continue;
+		}
+		append(&pending, (char*)iov[v].iov_base+s, iov[v].iov_len-s);
+		s = 0;
+	}
+	if (w == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		pending.top = 0;
+	}
+	if (pending.top) loop_fd(STDOUT_FILENO, POLLOUT, _drain, NULL);
+	return w;
+}
+
+size_t output_pending(void) {
+	return pending.top;
+}
+
+/*
+ * Returns number of bytes still pending
+ */
+size_t output_drain(void) {
+	while (pending.top) {
+		const ssize_t w = write(STDOUT_FILENO, pending.buf, pending.top);
+		if (w == -1) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) pending.top = 0;
+			break;
+		}
+		memmove(pending.buf, pending.buf+w, pending.top-w);
+		pending.top -= w;
+	}
+	if (!pending.top) loop_fd(STDOUT_FILENO, 0, NULL, NULL);
+	return pending.top;
+}
+
+/*
+ * Frames are written to non-blocking stdout,
+ * so that slow terminal never blocks the UI
+ * Switching back to blocking mode sends everything pending
+ */
+int output_nonblock(const bool nb) {
+	const int fl = fcntl(STDOUT_FILENO, F_GETFL);
+	if (fl == -1
+	|| fcntl(STDOUT_FILENO, F_SETFL, (nb ? fl | O_NONBLOCK : fl & ~O_NONBLOCK))) {
+		return errno;
+	}
+	if (!nb) output_drain();
+	return 0;
+}
+
+/*
+ * Input ring
+ * Everything available on stdin is read at once
+ * and then decoded key by key
+ */
+static struct {
+	char b[INPUT_RING_SIZE];
+	size_t r, w; // not wrapped; w-r = bytes available
+} in;
+
+#define RING(N) (in.b[(N) & (INPUT_RING_SIZE-1)])
+
+static size_t _avail(void) {
+	return in.w - in.r;
+}
+
+/*
+ * stdin may share file description with stdout
+ * and therefore be non-blocking; EAGAIN reads nothing
+ */
+static ssize_t _fill(const int fd) {
+	const size_t wi = in.w & (INPUT_RING_SIZE-1);
+	const size_t fr = INPUT_RING_SIZE - _avail();
+	if (!fr) return 0;
+	struct iovec iov[2];
+	int n = 1;
+	iov[0].iov_base = in.b+wi;
+	iov[0].iov_len = fr;
+	if (fr > INPUT_RING_SIZE - wi) {
+		iov[0].iov_len = INPUT_RING_SIZE - wi;
+		iov[1].iov_base = in.b;
+		iov[1].iov_len = fr - iov[0].iov_len;
+		n = 2;
 	}
 	ssize_t rd;
 	do {
-		if (timeout_us > 0) {
-			retval = pselect(fd+1, &rfds, NULL, NULL, &T, NULL);
-			if (retval == -1 || !retval) {
-				FD_CLR(fd, &rfds);
-				return 0;
-			}
-		}
-		rd = read(fd, buf, count);
-	} while (rd < 0 && errno == EINTR && errno == EAGAIN);
-	FD_CLR(fd, &rfds);
+		rd = readv(fd, iov, n);
+	} while (rd == -1 && errno == EINTR);
+	if (rd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+	if (rd > 0) in.w += rd;
 	return rd;
 }
 
-static enum input_type which_key(char* const seq) {
-	int i = 0;
-	while (SKM[i].seq != NULL && SKM[i].t != I_NONE) {
-		if (!strcmp(SKM[i].seq, seq)) return SKM[i].t;
-		i += 1;
-	}
-	return I_NONE;
+/*
+ * Trie of escape sequences from SKM[]
+ * Node 0 is root; 0 also means 'no child/sibling'
+ */
+static struct key_node {
+	char c;
+	enum input_type t : 8;
+	unsigned char child, next;
+} KT[SKM_TRIE_SIZE];
+static size_t ktn;
+
+static size_t _kt_find(size_t k, const char c) {
+	for (k = KT[k].child; k && KT[k].c != c; k = KT[k].next);
+	return k;
 }
 
-struct input get_input(int timeout_us) {
-	const int fd = STDIN_FILENO;
-	struct input i;
-	memset(&i, 0, sizeof(struct input));
-	int utflen;
-	char seq[7];
-	memset(seq, 0, sizeof(seq));
-	if (xread(fd, seq, 1, timeout_us) == 1 && seq[0] == '\x1b') {
-		if (xread(fd, seq+1, 1, ESC_TIMEOUT_MS*1000) == 1
-		&& (seq[1] == '[' || seq[1] == 'O')) {
-			if (xread(fd, seq+2, 1, 0) == 1
-			&& '0' <= seq[2] && seq[2] <= '9') {
-				xread(fd, seq+3, 1, 0);
+static void _kt_build(void) {
+	ktn = 1;
+	for (size_t s = 0; SKM[s].seq; ++s) {
+		size_t k = 0;
+		for (const char* c = SKM[s].seq; *c; ++c) {
+			size_t n = _kt_find(k, *c);
+			if (!n) {
+				n = ktn++;
+				KT[n].c = *c;
+				KT[n].next = KT[k].child;
+				KT[k].child = n;
 			}
+			k = n;
+		}
+		KT[k].t = SKM[s].t;
+	}
+}
+
+/*
+ * Decodes escape sequence starting at in.r
+ * Returns number of bytes used; 0 if sequence may continue
+ * but no more bytes are available yet (and more are expected)
+ * Unknown sequences are consumed whole and give I_NONE
+ */
+static size_t _decode_esc(struct input* const i, const size_t n,
+		const bool more) {
+	if (!ktn) _kt_build();
+	size_t k = 0, b = 0;
+	while (b < n) {
+		const size_t c = _kt_find(k, RING(in.r+b));
+		if (!c) break;
+		k = c;
+		b += 1;
+		if (!KT[k].child) {
+			i->t = KT[k].t;
+			return b;
 		}
-		i.t = which_key(seq);
 	}
-	else if (seq[0] == 0x7f) {
+	if (b == n) {
+		if (more) return 0;
+		/* Lone ESC or truncated sequence */
+		i->t = (b == 1 ? KT[k].t : I_NONE);
+		return b;
+	}
+	if (b >= 2 && RING(in.r+1) == '[') {
+		/* Skip unknown CSI up to its final byte */
+		for (; b < n; ++b) {
+			const char c = RING(in.r+b);
+			if (0x40 <= c && c <= 0x7e) return b+1;
+		}
+		return (more ? 0 : n);
+	}
+	return b+1;
+}
+
+/*
+ * Decodes one key at in.r; see _decode_esc()
+ */
+static size_t _decode(struct input* const i, const size_t n,
+		const bool more) {
+	memset(i, 0, sizeof(struct input));
+	if (!n) return 0;
+	const char c = RING(in.r);
+	if (c == '\x1b') {
+		return _decode_esc(i, n, more);
+	}
+	else if (c == 0x7f) {
 #if defined(__linux__) || defined(__linux) || defined(linux)
-		i.t = I_BACKSPACE;
+		i->t = I_BACKSPACE;
 #else
-		i.t = I_DELETE;
+		i->t = I_DELETE;
 #endif
+		return 1;
 	}
-	else if (!(seq[0] & 0x60)) {
-		i.t = I_CTRL;
-		i.utf[0] = seq[0] | 0x40;
-	}
-	else if ((utflen = utf8_g2nb(seq))) {
-		i.t = I_UTF8;
-		i.utf[0] = seq[0];
-		int b;
-		for (b = 1; b < utflen; ++b) {
-			if (xread(fd, i.utf+b, 1, 0) != 1) {
-				i.t = I_NONE;
-				memset(i.utf, 0, 5);
-				return i;
-			}
-		}
-		for (; b < 5; ++b) {
-			i.utf[b] = 0;
+	else if (!(c & 0x60)) {
+		i->t = I_CTRL;
+		i->utf[0] = c | 0x40;
+		return 1;
+	}
+	const size_t utflen = utf8_g2nb(&c);
+	if (!utflen) return 1;
+	if (n < utflen) {
+		return (more ? 0 : n);
+	}
+	i->t = I_UTF8;
+	for (size_t b = 0; b < utflen; ++b) {
+		i->utf[b] = RING(in.r+b);
+	}
+	return utflen;
+}
+
+/*
+ * Returns true if some input was read, but not decoded yet
+ */
+bool input_pending(void) {
+	return _avail() != 0;
+}
+
+struct input get_input(int timeout_us) {
+	const int fd = STDIN_FILENO;
+	struct input i;
+	size_t s;
+	while (!(s = _decode(&i, _avail(), true))) {
+		/* Rest of a key should follow its first byte
+		 * shortly; otherwise ESC was pressed */
+		const bool part = _avail() != 0;
+		if (loop_wait(fd, (part ? ESC_TIMEOUT_MS*1000 : timeout_us)) != 1
+		|| _fill(fd) <= 0) {
+			if (!part) return i;
+			s = _decode(&i, _avail(), false);
+			break;
 		}
 	}
+	in.r += s;
 	return i;
 }
 
@@ -110,10 +287,12 @@ int start_raw_mode(struct termios* const before) {
 	raw.c_iflag &= ~(BRKINT);
 	raw.c_lflag |= ISIG;
 	write(STDOUT_FILENO, CSI_CURSOR_HIDE); // TODO
-	return (tcsetattr(fd, TCSAFLUSH, &raw) ? errno : 0);
+	if (tcsetattr(fd, TCSAFLUSH, &raw)) return errno;
+	return output_nonblock(true);
 }
 
 int stop_raw_mode(struct termios* const before) {
+	output_nonblock(false);
 	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, before)) {
 		return errno;
 	}
@@ -161,16 +340,25 @@ int window_size(int* const R, int* const C) {
 	return 0;
 }
 
+/*
+ * Makes sure there is space for s more bytes
+ * Capacity grows geometrically and is never given back
+ */
+static int _reserve(struct append_buffer* const ab, const size_t s) {
+	if (ab->capacity - ab->top >= s) return 0;
+	size_t c = (ab->capacity ? ab->capacity : APPEND_BUFFER_INC);
+	while (c - ab->top < s) c *= 2;
+	void* tmp = realloc(ab->buf, c);
+	if (!tmp) return ENOMEM;
+	ab->buf = tmp;
+	ab->capacity = c;
+	ab->allocs += 1;
+	return 0;
+}
+
 size_t append(struct append_buffer* const ab,
 		const char* const b, const size_t s) {
-	if (ab->capacity - ab->top < s) {
-		do {
-			ab->capacity += APPEND_BUFFER_INC;
-		} while (ab->capacity - ab->top < s);
-		void* tmp = realloc(ab->buf, ab->capacity);
-		if (!tmp) return 0;
-		ab->buf = tmp;
-	}
+	if (_reserve(ab, s)) return 0;
 	memcpy(ab->buf+ab->top, b, s);
 	ab->top += s;
 	return s;
@@ -184,15 +372,486 @@ size_t append_attr(struct append_buffer* const ab,
 }
 
 size_t fill(struct append_buffer* const ab, const char C, const size_t s) {
-	if (ab->capacity - ab->top < s) {
-		do {
-			ab->capacity += APPEND_BUFFER_INC;
-		} while (ab->capacity - ab->top < s);
-		void* tmp = realloc(ab->buf, ab->capacity);
-		if (!tmp) return 0;
-		ab->buf = tmp;
-	}
+	if (_reserve(ab, s)) return 0;
 	memset(ab->buf+ab->top, C, s);
 	ab->top += s;
 	return s;
 }
+
+static const struct attr attr_default = { COLOR_DEFAULT, COLOR_DEFAULT, 0 };
+
+static bool attr_eq(const struct attr* const a, const struct attr* const b) {
+	return a->fg == b->fg && a->bg == b->bg && a->f == b->f;
+}
+
+static bool cell_eq(const struct cell* const a, const struct cell* const b) {
+	return !memcmp(a->g, b->g, CELL_GLYPH_SIZE) && attr_eq(&a->a, &b->a);
+}
+
+static void cell_blank(struct cell* const c, const struct attr* const a) {
+	memset(c->g, 0, CELL_GLYPH_SIZE);
+	c->g[0] = ' ';
+	c->a = *a;
+}
+
+int grid_resize(struct grid* const g, const int h, const int w) {
+	if (g->h == h && g->w == w && g->C) return 0;
+	if (h <= 0 || w <= 0) {
+		g->h = g->w = 0;
+		return 0;
+	}
+	const size_t n = (size_t)h*w;
+	if (n > g->cap) {
+		struct cell* C = realloc(g->C, n*sizeof(struct cell));
+		if (!C) return ENOMEM;
+		g->C = C;
+		struct cell* S = realloc(g->S, n*sizeof(struct cell));
+		if (!S) return ENOMEM;
+		g->S = S;
+		g->cap = n;
+		g->allocs += 2;
+	}
+	g->h = h;
+	g->w = w;
+	for (size_t c = 0; c < n; ++c) {
+		cell_blank(&g->C[c], &attr_default);
+	}
+	grid_goto(g, 0, 0);
+	g->a = attr_default;
+	grid_invalidate(g);
+	return 0;
+}
+
+void grid_free(struct grid* const g) {
+	free(g->C);
+	free(g->S);
+	memset(g, 0, sizeof(struct grid));
+}
+
+void grid_invalidate(struct grid* const g) {
+	g->full = true;
+	g->nsc = 0;
+}
+
+void grid_goto(struct grid* const g, const int y, const int x) {
+	g->y = y;
+	g->x = x;
+	g->xe = g->w;
+}
+
+/*
+ * Overwriting a half of a double-width glyph
+ * leaves the other half blank.
+ */
+static void _unsplit(struct cell* const row, const int w, const int x) {
+	if (x > 0 && !row[x].g[0]) {
+		cell_blank(&row[x-1], &row[x-1].a);
+	}
+	if (x+1 < w && !row[x+1].g[0]) {
+		cell_blank(&row[x+1], &row[x+1].a);
+	}
+}
+
+static void _put_glyph(struct grid* const g, const char* const b,
+		const size_t nb, const size_t gw) {
+	struct cell* const row = g->C + g->y*g->w;
+	if ((unsigned char)b[0] < ' ' || b[0] == 0x7f) return;
+	if (!gw) {
+		/* Zero-width glyphs are attached to the previous glyph */
+		if (!g->x) return;
+		struct cell* c = &row[g->x-1];
+		if (!c->g[0] && g->x > 1) c = &row[g->x-2];
+		const size_t l = strnlen(c->g, CELL_GLYPH_SIZE);
+		if (l+nb < CELL_GLYPH_SIZE) memcpy(c->g+l, b, nb);
+		return;
+	}
+	if (g->x+(int)gw > g->xe) {
+		while (g->x < g->xe) {
+			_unsplit(row, g->w, g->x);
+			cell_blank(&row[g->x], &g->a);
+			g->x += 1;
+		}
+		return;
+	}
+	_unsplit(row, g->w, g->x);
+	if (gw == 2) _unsplit(row, g->w, g->x+1);
+	memset(row[g->x].g, 0, CELL_GLYPH_SIZE);
+	memcpy(row[g->x].g, b, nb);
+	row[g->x].a = g->a;
+	if (gw == 2) {
+		memset(row[g->x+1].g, 0, CELL_GLYPH_SIZE);
+		row[g->x+1].a = g->a;
+	}
+	g->x += gw;
+}
+
+/*
+ * Puts at most n bytes of UTF-8 string into grid
+ * Returns number of bytes consumed
+ */
+size_t grid_put(struct grid* const g, const char* const s, const size_t n) {
+	size_t i = 0;
+	if (g->y < 0 || g->y >= g->h) return 0;
+	while (i < n && s[i] && g->x < g->xe) {
+		const size_t nb = utf8_g2nb(s+i);
+		if (!nb || i+nb > n) {
+			_put_glyph(g, "?", 1, 1);
+			i += 1;
+			continue;
+		}
+		_put_glyph(g, s+i, nb, utf8_g2w(utf8_b2cp(s+i)));
+		i += nb;
+	}
+	return i;
+}
+
+size_t grid_fill(struct grid* const g, const char c, size_t n) {
+	if (g->y < 0 || g->y >= g->h || g->x >= g->xe) return 0;
+	if (n > (size_t)(g->xe - g->x)) n = g->xe - g->x;
+	for (size_t j = 0; j < n; ++j) {
+		_put_glyph(g, &c, 1, 1);
+	}
+	return n;
+}
+
+static color_t _color(const int F, const unsigned char* const v) {
+	const char C = F & 0x7f;
+	if (C) return (C == ATTR_DEFAULT ? COLOR_DEFAULT : COLOR_BASIC(C-'0'));
+	if (F & ATTR_COLOR_256) return COLOR_256(v[0]);
+	if (F & ATTR_COLOR_TRUE) return COLOR_TRUE(v[0], v[1], v[2]);
+	return COLOR_DEFAULT;
+}
+
+/*
+ * Changes attributes of glyphs that will be put into grid
+ * Takes the same arguments as char_attr()
+ */
+void grid_attr(struct grid* const g, const int F,
+		const unsigned char* const v) {
+	static const unsigned char set[32] = {
+		[ATTR_BOLD] = AF_BOLD,
+		[ATTR_FAINT] = AF_FAINT,
+		[ATTR_ITALIC] = AF_ITALIC,
+		[ATTR_UNDERLINE] = AF_UNDERLINE,
+		[ATTR_BLINK] = AF_BLINK,
+		[ATTR_INVERSE] = AF_INVERSE,
+		[ATTR_INVISIBLE] = AF_INVISIBLE,
+	};
+	static const unsigned char unset[32] = {
+		[ATTR_NOT_BOLD_OR_FAINT] = AF_BOLD | AF_FAINT,
+		[ATTR_NOT_ITALIC] = AF_ITALIC,
+		[ATTR_NOT_UNDERLINE] = AF_UNDERLINE,
+		[ATTR_NOT_BLINK] = AF_BLINK,
+		[ATTR_NOT_INVERSE] = AF_INVERSE,
+		[ATTR_NOT_INVISIBLE] = AF_INVISIBLE,
+	};
+	if (F < 32) {
+		if (F == ATTR_NORMAL) {
+			g->a = attr_default;
+		}
+		g->a.f |= set[F];
+		g->a.f &= ~unset[F];
+		return;
+	}
+	if (F & ATTR_FOREGROUND) {
+		g->a.fg = _color(F, v);
+	}
+	else if (F & ATTR_BACKGROUND) {
+		g->a.bg = _color(F, v);
+	}
+}
+
+/*
+ * Blanks the rest of the line and moves to the next one
+ */
+void grid_eol(struct grid* const g) {
+	const struct attr a = g->a;
+	g->a = attr_default;
+	g->xe = g->w;
+	grid_fill(g, ' ', g->w - g->x);
+	g->a = a;
+	grid_goto(g, g->y+1, 0);
+}
+
+/*
+ * Moves terminal cursor, trying to do it with as few bytes as possible
+ */
+void grid_cursor(struct grid* const g, struct append_buffer* const ab,
+		const int y, const int x) {
+	char buf[1+1+10+1+10+1+1];
+	int n;
+	if (g->ty == y && g->tx == x) return;
+	if (g->ty == y && g->tx >= 0 && g->tx < x) {
+		/* A few glyphs that are already on the screen
+		 * may be shorter than a cursor movement */
+		const struct cell* const S = g->S + y*g->w;
+		size_t nb = 0;
+		int c = g->tx;
+		while (c < x && nb <= 3 && S[c].g[0] && attr_eq(&S[c].a, &g->ta)
+		&& !(c+1 < g->w && !S[c+1].g[0])) {
+			nb += strnlen(S[c].g, CELL_GLYPH_SIZE);
+			c += 1;
+		}
+		if (c == x && nb <= 3) {
+			for (c = g->tx; c < x; ++c) {
+				append(ab, S[c].g, strnlen(S[c].g, CELL_GLYPH_SIZE));
+			}
+			g->tx = x;
+			return;
+		}
+		n = snprintf(buf, sizeof(buf), "\x1b[%dC", x - g->tx);
+	}
+	else if (!x && g->ty >= 0 && y == g->ty+1) {
+		n = snprintf(buf, sizeof(buf), "\r\n");
+	}
+	else if (!x && g->ty >= 0 && y == g->ty) {
+		n = snprintf(buf, sizeof(buf), "\r");
+	}
+	else if (!x) {
+		n = snprintf(buf, sizeof(buf), "\x1b[%dH", y+1);
+	}
+	else {
+		n = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y+1, x+1);
+	}
+	append(ab, buf, n);
+	g->ty = y;
+	g->tx = x;
+}
+
+/*
+ * Decimal representations of 0-255 for SGR parameters
+ */
+static const char* _dec8(const unsigned char v) {
+	static char dec[256][4];
+	if (!dec[0][0]) {
+		for (int n = 0; n < 256; ++n) {
+			char* p = dec[n];
+			if (n >= 100) *p++ = '0'+n/100;
+			if (n >= 10) *p++ = '0'+n/10%10;
+			*p = '0'+n%10;
+		}
+	}
+	return dec[v];
+}
+
+static size_t _param(char* const p, const char* const s) {
+	const size_t l = strlen(s);
+	p[0] = ';';
+	memcpy(p+1, s, l);
+	return 1+l;
+}
+
+static size_t _sgr_flags(char* const p, const unsigned char f) {
+	static const char* const on[] = { "1", "2", "3", "4", "5", "7", "8" };
+	size_t n = 0;
+	for (size_t b = 0; b < sizeof(on)/sizeof(on[0]); ++b) {
+		if (f & (1 << b)) n += _param(p+n, on[b]);
+	}
+	return n;
+}
+
+static size_t _sgr_color(char* const p, const int fb, const color_t c) {
+	static const char* const basic[2][8] = {
+		{ "30", "31", "32", "33", "34", "35", "36", "37" },
+		{ "40", "41", "42", "43", "44", "45", "46", "47" },
+	};
+	static const char* const ext[2][2] = {
+		{ "38;5", "38;2" },
+		{ "48;5", "48;2" },
+	};
+	size_t n = 0;
+	switch (COLOR_KIND(c)) {
+	case 1:
+		n += _param(p, basic[fb][c & 7]);
+		break;
+	case 2:
+		n += _param(p, ext[fb][0]);
+		n += _param(p+n, _dec8(c & 0xff));
+		break;
+	case 3:
+		n += _param(p, ext[fb][1]);
+		n += _param(p+n, _dec8((c >> 16) & 0xff));
+		n += _param(p+n, _dec8((c >> 8) & 0xff));
+		n += _param(p+n, _dec8(c & 0xff));
+		break;
+	default:
+		n += _param(p, fb ? "49" : "39");
+		break;
+	}
+	return n;
+}
+
+/*
+ * Emits a single SGR sequence that changes terminal attributes
+ * from g->ta to a. Picks the shorter of the delta
+ * and a reset followed by everything that a needs.
+ */
+static void _sgr(struct grid* const g, struct append_buffer* const ab,
+		const struct attr* const a) {
+	static const char* const off[] = { "22", "22", "23", "24", "25", "27", "28" };
+	char D[6*(1+2)+7*(1+1)+2*(1+4+3*(1+3))];
+	char R[1+1+7*(1+1)+2*(1+4+3*(1+3))];
+	size_t dn = 0, rn = 0;
+	if (attr_eq(a, &g->ta)) return;
+
+	const unsigned char fo = g->ta.f & ~a->f;
+	unsigned char fn = a->f & ~g->ta.f;
+	bool bf = false;
+	for (size_t b = 0; b < sizeof(off)/sizeof(off[0]); ++b) {
+		if (!(fo & (1 << b))) continue;
+		if (b < 2) {
+			/* 22 turns off both bold and faint */
+			if (bf) continue;
+			bf = true;
+			fn |= a->f & (AF_BOLD | AF_FAINT);
+		}
+		dn += _param(D+dn, off[b]);
+	}
+	dn += _sgr_flags(D+dn, fn);
+	if (a->fg != g->ta.fg) dn += _sgr_color(D+dn, 0, a->fg);
+	if (a->bg != g->ta.bg) dn += _sgr_color(D+dn, 1, a->bg);
+
+	R[rn++] = ';';
+	R[rn++] = '0';
+	rn += _sgr_flags(R+rn, a->f);
+	if (a->fg != COLOR_DEFAULT) rn += _sgr_color(R+rn, 0, a->fg);
+	if (a->bg != COLOR_DEFAULT) rn += _sgr_color(R+rn, 1, a->bg);
+
+	const char* const P = (rn < dn ? R : D);
+	const size_t pn = (rn < dn ? rn : dn);
+	append(ab, "\x1b[", 2);
+	append(ab, P+1, pn-1); // Skip first ';'
+	append(ab, "m", 1);
+	g->ta = *a;
+}
+
+/*
+ * Adds a scroll hint; see struct grid_scroll
+ * grid_flush() decides if scrolling is cheaper than redrawing
+ */
+void grid_scroll(struct grid* const g, const int top, const int bot,
+		const int l, const int r, const int n) {
+	if (g->nsc >= GRID_SCROLL_HINTS || top < 0 || bot >= g->h || top >= bot
+	|| l < 0 || r >= g->w || l > r || !n || abs(n) > bot-top) return;
+	struct grid_scroll* const s = &g->sc[g->nsc];
+	s->top = top;
+	s->bot = bot;
+	s->l = (g->lrm ? l : 0);
+	s->r = (g->lrm ? r : g->w-1);
+	s->n = n;
+	g->nsc += 1;
+}
+
+/*
+ * How many cells of the region would differ from C
+ * if the screen was scrolled by n rows
+ */
+static size_t _scroll_cost(const struct grid* const g,
+		const struct grid_scroll* const s, const int n) {
+	struct cell blank;
+	cell_blank(&blank, &attr_default);
+	size_t d = 0;
+	for (int y = s->top; y <= s->bot; ++y) {
+		const struct cell* const C = g->C + y*g->w;
+		const struct cell* S = NULL;
+		if (y+n >= s->top && y+n <= s->bot) S = g->S + (y+n)*g->w;
+		for (int x = s->l; x <= s->r; ++x) {
+			d += !cell_eq(&C[x], (S ? &S[x] : &blank));
+		}
+	}
+	return d;
+}
+
+/*
+ * Wide glyphs on the screen must not cross left/right margins
+ */
+static bool _scroll_splits(const struct grid* const g,
+		const struct grid_scroll* const s) {
+	for (int y = s->top; y <= s->bot; ++y) {
+		const struct cell* const S = g->S + y*g->w;
+		if (!S[s->l].g[0]) return true;
+		if (s->r+1 < g->w && !S[s->r+1].g[0]) return true;
+	}
+	return false;
+}
+
+static void _scroll(struct grid* const g, struct append_buffer* const ab,
+		const struct grid_scroll* const s) {
+	char buf[8+2*(2+10+1+10+1)+2+10+1+3+6];
+	const bool lr = s->l != 0 || s->r != g->w-1;
+	if (_scroll_splits(g, s)) return;
+	int n = 0;
+	if (lr) {
+		n += snprintf(buf+n, sizeof(buf)-n, "\x1b[?69h\x1b[%d;%ds",
+				s->l+1, s->r+1);
+	}
+	n += snprintf(buf+n, sizeof(buf)-n, "\x1b[%d;%dr\x1b[%d%c\x1b[r",
+			s->top+1, s->bot+1, abs(s->n), (s->n > 0 ? 'S' : 'T'));
+	if (lr) n += snprintf(buf+n, sizeof(buf)-n, "\x1b[?69l");
+	if (_scroll_cost(g, s, s->n) + n >= _scroll_cost(g, s, 0)) return;
+
+	/* Exposed lines are filled with current background color */
+	_sgr(g, ab, &attr_default);
+	append(ab, buf, n);
+	g->ty = g->tx = -1; // DECSTBM moves cursor home
+	const int w = s->r - s->l + 1;
+	if (s->n > 0) {
+		for (int y = s->top; y <= s->bot; ++y) {
+			struct cell* const S = g->S + y*g->w + s->l;
+			if (y+s->n <= s->bot) {
+				memcpy(S, S+s->n*g->w, w*sizeof(struct cell));
+			}
+			else for (int x = 0; x < w; ++x) {
+				cell_blank(&S[x], &attr_default);
+			}
+		}
+	}
+	else {
+		for (int y = s->bot; y >= s->top; --y) {
+			struct cell* const S = g->S + y*g->w + s->l;
+			if (y+s->n >= s->top) {
+				memcpy(S, S+s->n*g->w, w*sizeof(struct cell));
+			}
+			else for (int x = 0; x < w; ++x) {
+				cell_blank(&S[x], &attr_default);
+			}
+		}
+	}
+}
+
+/*
+ * Appends to ab everything needed to make the screen look like C
+ * Returns number of bytes appended
+ */
+size_t grid_flush(struct grid* const g, struct append_buffer* const ab) {
+	const size_t top = ab->top;
+	if (g->full) {
+		append(ab, "\x1b[0m\x1b[H\x1b[2J", 3+1+3+4);
+		for (size_t c = 0; c < (size_t)g->h*g->w; ++c) {
+			cell_blank(&g->S[c], &attr_default);
+		}
+		g->ta = attr_default;
+		g->ty = g->tx = 0;
+		g->full = false;
+		g->nsc = 0;
+	}
+	for (int s = 0; s < g->nsc; ++s) {
+		_scroll(g, ab, &g->sc[s]);
+	}
+	g->nsc = 0;
+	for (int y = 0; y < g->h; ++y) {
+		struct cell* const C = g->C + y*g->w;
+		struct cell* const S = g->S + y*g->w;
+		for (int x = 0; x < g->w; ++x) {
+			if (cell_eq(&C[x], &S[x])) continue;
+			S[x] = C[x];
+			if (!C[x].g[0]) continue;
+			grid_cursor(g, ab, y, x);
+			_sgr(g, ab, &C[x].a);
+			append(ab, C[x].g, strnlen(C[x].g, CELL_GLYPH_SIZE));
+			g->tx += ((x+1 < g->w && !C[x+1].g[0]) ? 2 : 1);
+			if (g->tx >= g->w) g->tx = -1; // Pending wrap
+		}
+	}
+	return ab->top - top;
+}
@@ -26,16 +26,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <termios.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/select.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 
 #include "utf8.h"
+#include "loop.h"
 
 #define ESC_TIMEOUT_MS 125
+#define INPUT_RING_SIZE 4096 // power of 2
+#define SKM_TRIE_SIZE 64
 
 #define CTRL_KEY(K) ((K) & 0x1f)
 
@@ -100,9 +106,9 @@ static const struct s2i SKM[] = {
 	{ NULL, I_NONE },
 };
 
-ssize_t xread(int, void*, ssize_t, int);
 int start_raw_mode(struct termios* const);
 int stop_raw_mode(struct termios* const);
+bool input_pending(void);
 struct input get_input(int);
 
 enum char_attr {
@@ -144,11 +150,17 @@ int char_attr(char* const, const size_t, const int,
 int move_cursor(const unsigned int, const unsigned int);
 int window_size(int* const, int* const);
 
+ssize_t output_frame(const struct iovec* const, const int);
+size_t output_pending(void);
+size_t output_drain(void);
+int output_nonblock(const bool);
+
 #define APPEND_BUFFER_INC 64
 struct append_buffer {
 	char* buf;
 	size_t top;
 	size_t capacity;
+	unsigned long allocs;
 };
 
 size_t append(struct append_buffer* const, const char* const, const size_t);
@@ -156,6 +168,101 @@ size_t append_attr(struct append_buffer* const, const int,
 		const unsigned char* const);
 size_t fill(struct append_buffer* const, const char, const size_t);
 
+/*
+ * Colors are packed into a single integer.
+ * Top byte tells what kind of color it is, the rest is the value.
+ */
+typedef uint32_t color_t;
+
+#define COLOR_DEFAULT 0
+#define COLOR_BASIC(C) ((color_t)1<<24 | (C))
+#define COLOR_256(V) ((color_t)2<<24 | (V))
+#define COLOR_TRUE(R,G,B) ((color_t)3<<24 | (R)<<16 | (G)<<8 | (B))
+#define COLOR_KIND(C) ((C) >> 24)
+
+enum attr_flag {
+	AF_BOLD = 1<<0,
+	AF_FAINT = 1<<1,
+	AF_ITALIC = 1<<2,
+	AF_UNDERLINE = 1<<3,
+	AF_BLINK = 1<<4,
+	AF_INVERSE = 1<<5,
+	AF_INVISIBLE = 1<<6,
+};
+
+struct attr {
+	color_t fg, bg;
+	unsigned char f; // enum attr_flag
+};
+
+#define CELL_GLYPH_SIZE 8
+
+struct cell {
+	// Zero-terminated UTF-8 glyph (+ zero-width glyphs, if they fit)
+	// Empty glyph = right half of a double-width glyph on the left
+	char g[CELL_GLYPH_SIZE];
+	struct attr a;
+};
+
+/*
+ * Rows top-bot, columns l-r (inclusive) of C may be
+ * what is on the screen, moved by n rows (n > 0 = up)
+ */
+struct grid_scroll {
+	int top, bot, l, r, n;
+};
+
+#define GRID_SCROLL_HINTS 2
+
+/*
+ * Cell grid
+ *
+ * UI is composed into C (glyphs + attributes),
+ * then grid_flush() compares it with S (what the terminal displays)
+ * and outputs only the cells that differ.
+ *
+ * Composing functions never write outside of the grid
+ * and never write past xe (x end), which grid_goto() resets to w.
+ */
+struct grid {
+	int h, w;
+	struct cell* C; // Composed frame
+	struct cell* S; // Screen
+	int y, x, xe; // Composing position
+	struct attr a; // Composing attributes
+	int ty, tx; // Terminal cursor position; -1 = unknown
+	struct attr ta; // Terminal attributes
+	bool full; // Screen contents are unknown; clear and redraw all
+	size_t cap; // Allocated cells; shrinking keeps memory
+	unsigned long allocs;
+	bool lrm; // Terminal supports left/right margins (DECSLRM)
+	int nsc;
+	struct grid_scroll sc[GRID_SCROLL_HINTS];
+};
+
+int grid_resize(struct grid* const, const int, const int);
+void grid_free(struct grid* const);
+void grid_invalidate(struct grid* const);
+void grid_goto(struct grid* const, const int, const int);
+size_t grid_put(struct grid* const, const char* const, const size_t);
+size_t grid_fill(struct grid* const, const char, size_t);
+void grid_attr(struct grid* const, const int, const unsigned char* const);
+void grid_eol(struct grid* const);
+void grid_cursor(struct grid* const, struct append_buffer* const,
+		const int, const int);
+void grid_scroll(struct grid* const, const int, const int,
+		const int, const int, const int);
+size_t grid_flush(struct grid* const, struct append_buffer* const);
+
+struct output_stats {
+	unsigned long frames;
+	size_t bytes; // Last frame
+	unsigned long long bytes_total;
+	unsigned allocs, syscalls; // Last frame
+	unsigned long dropped; // Frames not sent because terminal was busy
+	size_t pending; // Bytes waiting for terminal
+};
+
 #define CSI_CLEAR_ALL "\x1b[2J", 4
 #define CSI_CLEAR_LINE "\x1b[K", 3
 #define CSI_CURSOR_TOP_LEFT "\x1b[H", 3
@@ -164,5 +271,7 @@ size_t fill(struct append_buffer* const, const char, const size_t);
 #define CSI_SCREEN_ALTERNATIVE "\x1b[?47h", 6
 #define CSI_SCREEN_NORMAL "\x1b[?47l", 6
 #define CSI_CURSOR_HIDE_TOP_LEFT "\x1b[?25l\x1b[H", 9
+#define CSI_SYNC_BEGIN "\x1b[?2026h", 8
+#define CSI_SYNC_END "\x1b[?2026l", 8
 
 #endif
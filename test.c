@@ -10,6 +10,45 @@
 #include "terminal.h"
 #include "ui.h"
 
+/*
+ * Writes n bytes of a pattern to path
+ */
+static bool _mkfile(const char* const path, const size_t n) {
+	const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) return false;
+	char b[26*256];
+	for (size_t k = 0; k < sizeof(b); ++k) b[k] = 'a' + k % 26;
+	bool ok = true;
+	for (size_t w = 0, l; ok && w < n; w += l) {
+		l = (n-w < sizeof(b) ? n-w : sizeof(b));
+		ok = write(fd, b, l) == (ssize_t)l;
+	}
+	close(fd);
+	return ok;
+}
+
+static bool _samefile(const char* const a, const char* const b) {
+	char ba[4096], bb[4096];
+	const int fa = open(a, O_RDONLY);
+	const int fb = open(b, O_RDONLY);
+	bool same = fa != -1 && fb != -1;
+	ssize_t ra, rb;
+	while (same && (ra = read(fa, ba, sizeof(ba))) > 0) {
+		rb = read(fb, bb, ra);
+		same = rb == ra && !memcmp(ba, bb, ra);
+	}
+	same = same && read(fb, bb, 1) == 0;
+	if (fa != -1) close(fa);
+	if (fb != -1) close(fb);
+	return same;
+}
+
+static bool _count(int n, void* data) {
+	(void)(n);
+	*(int*)data += 1;
+	return true;
+}
+
 int main() {
 	SETUP_TESTS;
 
@@ -380,6 +419,18 @@ int main() {
 	TESTVAL(utf8_w2nb("a", 0), 0, "");
 	TESTVAL(utf8_w2nb("a", 666), 1, "");
 	TESTVAL(utf8_w2nb("łłłłł", 666), 10, "");
+	TESTVAL(utf8_w2nb("0123456789abcdef", 10), 10, "");
+	TESTVAL(utf8_w2nb("\xe6\x97\xa5\xe6\x9c\xac", 3), 3, "wide glyph that does not fit");
+	TESTVAL(utf8_width("0123456789\xe6\x97\xa5" "abcdefgh"), 20, "");
+
+	bool tables = true;
+	for (codepoint_t cp = 0x7f; cp < 0x110000; ++cp) {
+		size_t w = 1;
+		if (cp_in(zero_width, zero_width_len-1, cp)) w = 0;
+		else if (cp_in(double_width, double_width_len-1, cp)) w = 2;
+		tables = tables && utf8_g2w(cp) == w;
+	}
+	TEST(tables, "two-stage table matches ranges");
 
 	char inserted[20] = "łąkała";
 	utf8_insert(inserted, "ń", 2);
@@ -399,6 +450,15 @@ int main() {
 	TESTSTR(inv, "works", "");
 	cut_unwanted("\xffwor\x1b\b\a\nks", inv, '.', NAME_MAX);
 	TESTSTR(inv, ".wor....ks", "");
+	cut_unwanted("\xc5x\xc5\x82\xe6\x97", inv, '.', NAME_MAX);
+	TESTSTR(inv, ".x\xc5\x82..", "bad continuation bytes");
+	cut_unwanted("0123456789abcdef0123456789\x7f\n", inv, '.', NAME_MAX);
+	TESTSTR(inv, "0123456789abcdef0123456789\x7f.", "");
+
+	TESTVAL(utf8_classify("0123456789abcdef0123", 20), UTF8_ASCII, "");
+	TESTVAL(utf8_classify("0123456789abcdef\xc5\x82", 18), UTF8_CLEAN, "");
+	TESTVAL(utf8_classify("0123456789abcdef\xc5", 17), UTF8_UNWANTED, "truncated");
+	TESTVAL(utf8_classify("a\tb", 3), UTF8_UNWANTED, "control character");
 
 	END_SECTION("utf8");
 
@@ -518,6 +578,550 @@ int main() {
 	list_free(&t.renamed);
 	free(t.tw.path);
 
+	char tdir[] = "/tmp/hund-test-XXXXXX";
+	char tsrc[PATH_BUF_SIZE], tdst[PATH_BUF_SIZE];
+	char tsf[PATH_BUF_SIZE], tdf[PATH_BUF_SIZE];
+	TEST(mkdtemp(tdir), "");
+	snprintf(tsrc, sizeof(tsrc), "%s/src", tdir);
+	snprintf(tdst, sizeof(tdst), "%s/dst", tdir);
+	snprintf(tsf, sizeof(tsf), "%s/src/f", tdir);
+	snprintf(tdf, sizeof(tdf), "%s/dst/f", tdir);
+	TEST(!mkdir(tsrc, 0755) && !mkdir(tdst, 0755), "");
+	TEST(_mkfile(tsf, 100000), "");
+	struct string_list S = { NULL, 0 }, R = { NULL, 0 };
+	list_push(&S, "f", -1);
+	TESTVAL(task_init(&t), 0, "");
+	task_new(&t, TASK_COPY, 0, tsrc, tdst, &S, &R);
+	TESTVAL(task_start(&t, task_action_estimate, TS_CONFIRM), 0, "");
+	task_join(&t);
+	TESTVAL(t.ts, TS_CONFIRM, "estimated on worker thread");
+	TESTVAL(t.size_total, 100000, "");
+	t.ts = TS_RUNNING;
+	TESTVAL(task_start(&t, task_action_copyremove, TS_FINISHED), 0, "");
+	task_join(&t);
+	TESTVAL(t.ts, TS_FINISHED, "copied on worker thread");
+	struct task_progress tp;
+	task_get_progress(&t, &tp);
+	TESTVAL(tp.size_done, 100000, "progress published");
+	TESTVAL(tp.files_done, 1, "");
+	TESTVAL(tp.eta, -1, "no ETA once finished");
+	TEST(tp.calls >= 1 && tp.data_ms <= tp.ms[1], "phase timing");
+	TEST(_samefile(tsf, tdf), "");
+	TEST(t.cms, "copy method recorded");
+	task_clean(&t);
+	unlink(tdf);
+	S.arr = NULL;
+	S.len = 0;
+	list_push(&S, "missing", -1);
+	task_new(&t, TASK_COPY, 0, tsrc, tdst, &S, &R);
+	TESTVAL(task_start(&t, task_action_estimate, TS_CONFIRM), 0, "");
+	task_join(&t);
+	TESTVAL(t.ts, TS_FAILED, "worker stops when walk can't start");
+	TESTVAL(t.err, ENOENT, "");
+	task_clean(&t);
+	S.arr = NULL;
+	S.len = 0;
+	list_push(&S, "f", -1);
+	task_new(&t, TASK_COPY, 0, tsrc, tdst, &S, &R);
+	t.cm = CM_RW;
+	t.ts = TS_RUNNING;
+	task_do(&t, task_action_copyremove, TS_FINISHED);
+	TESTVAL(t.ts, TS_FINISHED, "");
+	TESTVAL(t.cms, CM_RW, "read/write fallback");
+	TESTVAL(t.size_done, 100000, "");
+	TEST(_samefile(tsf, tdf), "");
+	task_clean(&t);
+	unlink(tdf);
+	TEST(_mkfile(tsf, 3*PIPE_MIN_FILE+12345), "");
+	S.arr = NULL;
+	S.len = 0;
+	list_push(&S, "f", -1);
+	task_new(&t, TASK_COPY, TF_NOCACHE, tsrc, tdst, &S, &R);
+	t.cm = CM_PIPE | CM_RW;
+	t.ts = TS_RUNNING;
+	task_do(&t, task_action_copyremove, TS_FINISHED);
+	TEST(t.cp.on && t.size_done < 3*PIPE_MIN_FILE, "pipeline runs");
+	task_message(&t, TM_PAUSE);
+	TESTVAL(t.ts, TS_PAUSED, "");
+	TEST(!t.cp.on, "pipeline stopped on pause");
+	t.ts = TS_RUNNING;
+	while (t.ts == TS_RUNNING) {
+		task_do(&t, task_action_copyremove, TS_FINISHED);
+	}
+	TESTVAL(t.ts, TS_FINISHED, "");
+	TESTVAL(t.cms, CM_PIPE, "pipeline when in-kernel copy is unavailable");
+	TESTVAL(t.size_done, 3*PIPE_MIN_FILE+12345, "");
+	TEST(_samefile(tsf, tdf), "resumed after pause");
+	task_get_progress(&t, &tp);
+	TEST(tp.rbusy >= 0 && tp.wbusy >= 0, "stage utilization");
+	task_clean(&t);
+	unlink(tdf);
+	const int sfd = open(tsf, O_WRONLY | O_TRUNC);
+	TEST(sfd != -1 && !ftruncate(sfd, 3*PIPE_MIN_FILE)
+		&& pwrite(sfd, "data", 4, 1024*1024) == 4
+		&& pwrite(sfd, "more", 4, PIPE_MIN_FILE) == 4, "");
+	close(sfd);
+	for (int m = 0; m < 2; ++m) {
+		S.arr = NULL;
+		S.len = 0;
+		list_push(&S, "f", -1);
+		task_new(&t, TASK_COPY, 0, tsrc, tdst, &S, &R);
+		t.cm &= (m ? CM_RW : ~CM_CLONE);
+		t.ts = TS_RUNNING;
+		while (t.ts == TS_RUNNING) {
+			task_do(&t, task_action_copyremove, TS_FINISHED);
+		}
+		TESTVAL(t.ts, TS_FINISHED, "");
+		TESTVAL(t.size_done, 3*PIPE_MIN_FILE, "holes count as done");
+		TEST(t.size_moved < 2*PIPE_MIN_FILE, "holes are not copied");
+		TEST(_samefile(tsf, tdf), "sparse copy");
+		struct stat sst, dst;
+		TEST(!stat(tsf, &sst) && !stat(tdf, &dst)
+			&& dst.st_size == 3*PIPE_MIN_FILE
+			&& dst.st_blocks <= sst.st_blocks + 64, "holes recreated");
+		task_clean(&t);
+		unlink(tdf);
+	}
+	char tsd[PATH_BUF_SIZE], tdd[PATH_BUF_SIZE];
+	snprintf(tsd, sizeof(tsd), "%s/src/d", tdir);
+	snprintf(tdd, sizeof(tdd), "%s/dst/d", tdir);
+	TEST(!mkdir(tsd, 0755) && !mkdir(tdd, 0755), "");
+	for (int k = 0; k < 100; ++k) {
+		snprintf(tsf, sizeof(tsf), "%s/src/d/f%d", tdir, k);
+		_mkfile(tsf, k*37);
+	}
+	snprintf(tdf, sizeof(tdf), "%s/dst/d/f5", tdir);
+	TEST(!mkdir(tdf, 0755), "");
+	S.arr = NULL;
+	S.len = 0;
+	list_push(&S, "d", -1);
+	task_new(&t, TASK_COPY, TF_OVERWRITE_CONFLICTS, tsrc, tdst, &S, &R);
+	t.ts = TS_RUNNING;
+	while (t.ts == TS_RUNNING) {
+		task_do(&t, task_action_copyremove, TS_FINISHED);
+	}
+	TESTVAL(t.ts, TS_FAILED, "");
+	TESTVAL(t.err, EISDIR, "");
+	TEST(t.ep && strstr(t.ep, "/src/d/f5"), "failed file of a batch");
+	TESTVAL(task_skip(&t), 0, "");
+	t.err = 0;
+	t.ts = TS_RUNNING;
+	while (t.ts == TS_RUNNING) {
+		task_do(&t, task_action_copyremove, TS_FINISHED);
+	}
+	TESTVAL(t.ts, TS_FINISHED, "");
+	TESTVAL(t.files_done, 99, "");
+	TEST((t.cms & CM_URING) || !(t.cm & CM_URING), "small files batched");
+	snprintf(tsf, sizeof(tsf), "%s/src/d/f99", tdir);
+	snprintf(tdf, sizeof(tdf), "%s/dst/d/f99", tdir);
+	TEST(_samefile(tsf, tdf), "");
+	task_clean(&t);
+	S.arr = NULL;
+	S.len = 0;
+	list_push(&S, "d", -1);
+	task_new(&t, TASK_REMOVE, 0, tsrc, tsrc, &S, &R);
+	t.ts = TS_RUNNING;
+	while (t.ts == TS_RUNNING) {
+		task_do(&t, task_action_copyremove, TS_FINISHED);
+	}
+	task_clean(&t);
+	S.arr = NULL;
+	S.len = 0;
+	list_push(&S, "d", -1);
+	task_new(&t, TASK_REMOVE, 0, tdst, tdst, &S, &R);
+	t.ts = TS_RUNNING;
+	while (t.ts == TS_RUNNING) {
+		task_do(&t, task_action_copyremove, TS_FINISHED);
+	}
+	TESTVAL(t.ts, TS_FINISHED, "");
+	task_clean(&t);
+	snprintf(tsd, sizeof(tsd), "%s/src/m", tdir);
+	TEST(!mkdir(tsd, 0755), "");
+	snprintf(tsd, sizeof(tsd), "%s/src/m/s", tdir);
+	TEST(!mkdir(tsd, 0755), "");
+	tsd[strlen(tsd)-1] = 'e';
+	TEST(!mkdir(tsd, 0700), "");
+	for (int k = 0; k < 10; ++k) {
+		snprintf(tsf, sizeof(tsf), "%s/src/m/f%d", tdir, k);
+		_mkfile(tsf, k*1000);
+	}
+	snprintf(tsf, sizeof(tsf), "%s/src/m/l", tdir);
+	TEST(!symlink("f1", tsf), "");
+	snprintf(tsf, sizeof(tsf), "%s/src/m/s/g", tdir);
+	snprintf(tdf, sizeof(tdf), "%s/dst/m/s/g", tdir);
+	TEST(_mkfile(tsf, 5000), "");
+	static const enum task_flags mft[3] = {
+		TF_RAW_LINKS,
+		TF_RAW_LINKS | TF_OVERWRITE_CONFLICTS,
+		TF_RAW_LINKS | TF_OVERWRITE_CONFLICTS,
+	};
+	for (int k = 0; k < 3; ++k) {
+		S.arr = NULL;
+		S.len = 0;
+		list_push(&S, "m", -1);
+		task_new(&t, TASK_COPY, mft[k], tsrc, tdst, &S, &R);
+		while (t.ts == TS_ESTIMATE) {
+			task_do(&t, task_action_estimate, TS_CONFIRM);
+		}
+		TESTVAL(t.mf.s, MF_READY, "estimate recorded manifest");
+		TESTVAL(t.conflicts, (k ? 15 : 0), "");
+		if (k == 2) {
+			snprintf(tsf, sizeof(tsf), "%s/src/m/s/h", tdir);
+			TEST(_mkfile(tsf, 7000), "");
+			snprintf(tdf, sizeof(tdf), "%s/dst/m/s/h", tdir);
+		}
+		t.ts = TS_RUNNING;
+		while (t.ts == TS_RUNNING) {
+			task_do(&t, task_action_copyremove, TS_FINISHED);
+		}
+		TESTVAL(t.ts, TS_FINISHED, "");
+		TESTVAL(t.mf.s, (k == 2 ? MF_OFF : MF_REPLAY),
+			"manifest replayed unless source changed");
+		TESTVAL(t.files_done, (k == 2 ? 13 : 12), "");
+		TESTVAL(t.dirs_done, 3, "");
+		TEST(_samefile(tsf, tdf), "");
+		task_clean(&t);
+	}
+	fnum_t ec[2][5];
+	ssize_t es[2];
+	size_t em[2];
+	for (int k = 0; k < 2; ++k) {
+		S.arr = NULL;
+		S.len = 0;
+		list_push(&S, "m", -1);
+		task_new(&t, TASK_COPY, 0, tsrc, tdst, &S, &R);
+		t.seq = k;
+		while (t.ts == TS_ESTIMATE && t.tw.tws != AT_LINK) {
+			task_do(&t, task_action_estimate, TS_CONFIRM);
+		}
+		TESTVAL(t.tw.tws, AT_LINK, "estimate stops to ask about links");
+		t.tf |= TF_RAW_LINKS;
+		while (t.ts == TS_ESTIMATE) {
+			task_do(&t, task_action_estimate, TS_CONFIRM);
+		}
+		TESTVAL(t.ts, TS_CONFIRM, "");
+		TEST(!t.wp, "walkers finished");
+		ec[k][0] = t.files_total;
+		ec[k][1] = t.dirs_total;
+		ec[k][2] = t.symlinks;
+		ec[k][3] = t.specials;
+		ec[k][4] = t.conflicts;
+		es[k] = t.size_total;
+		em[k] = t.mf.len;
+		task_clean(&t);
+	}
+	TESTVAL(ec[0][0], 13, "walkers count what walking alone does");
+	TESTVAL(ec[0][1], 3, "");
+	for (int k = 0; k < 5; ++k) {
+		TESTVAL(ec[0][k], ec[1][k], "");
+	}
+	TESTVAL(es[0], es[1], "");
+	TESTVAL(em[0], em[1], "manifest joined from units");
+	snprintf(tdf, sizeof(tdf), "%s/dst/m/e", tdir);
+	struct stat mfs;
+	TEST(!stat(tdf, &mfs) && (mfs.st_mode & 0777) == 0700, "");
+	snprintf(tdf, sizeof(tdf), "%s/dst/m/l", tdir);
+	TEST(!lstat(tdf, &mfs) && S_ISLNK(mfs.st_mode), "");
+	for (int k = 0; k < 2; ++k) {
+		S.arr = NULL;
+		S.len = 0;
+		list_push(&S, "m", -1);
+		task_new(&t, TASK_REMOVE, TF_RAW_LINKS, (k ? tdst : tsrc), "",
+			&S, &R);
+		while (t.ts == TS_ESTIMATE) {
+			task_do(&t, task_action_estimate, TS_CONFIRM);
+		}
+		t.ts = TS_RUNNING;
+		while (t.ts == TS_RUNNING) {
+			task_do(&t, task_action_copyremove, TS_FINISHED);
+		}
+		TESTVAL(t.ts, TS_FINISHED, "removed from manifest");
+		TESTVAL(t.mf.s, MF_REPLAY, "");
+		task_clean(&t);
+	}
+	char tsj[PATH_BUF_SIZE], tj[PATH_BUF_SIZE];
+	snprintf(tsj, sizeof(tsj), "%s/src/j", tdir);
+	TEST(!mkdir(tsj, 0755), "");
+	const ssize_t jsz[2] = { 10000, 40*1024*1024 };
+	for (int k = 0; k < 2; ++k) {
+		snprintf(tsf, sizeof(tsf), "%s/src/j/%c", tdir, 'a'+k);
+		TEST(_mkfile(tsf, jsz[k]), "");
+	}
+	S.arr = NULL;
+	S.len = 0;
+	list_push(&S, "a", -1);
+	task_new(&t, TASK_COPY, TF_JOURNAL, tsj, tdst, &S, &R);
+	while (t.ts == TS_ESTIMATE) {
+		task_do(&t, task_action_estimate, TS_CONFIRM);
+	}
+	task_clean(&t); // Aborted at confirmation
+	DIR* const jd = opendir(tdst);
+	struct dirent* jde;
+	while ((jde = readdir(jd)) && memcmp(jde->d_name, ".hund-j", 7));
+	TEST(!jde, "estimate doesn't create journal");
+	closedir(jd);
+	for (int k = 0; k < 2; ++k) {
+		S.arr = NULL;
+		S.len = 0;
+		list_push(&S, "a", -1);
+		list_push(&S, "b", -1);
+		task_new(&t, TASK_COPY, TF_JOURNAL, tsj, tdst, &S, &R);
+		while (k && t.ts == TS_ESTIMATE) {
+			task_do(&t, task_action_estimate, TS_CONFIRM);
+		}
+		if (k) TESTVAL(t.conflicts, 0, "journaled files are no conflict");
+		t.cm = CM_RANGE | CM_RW;
+		t.ts = TS_RUNNING;
+		if (!k) {
+			task_do(&t, task_action_copyremove, TS_FINISHED);
+			task_do(&t, task_action_copyremove, TS_FINISHED);
+			TESTVAL(t.files_done, 1, "interrupted in second file");
+			task_clean(&t);
+			/* As if second file was on disk up to 1MB */
+			DIR* const d = opendir(tdst);
+			struct dirent* de;
+			while ((de = readdir(d)) && memcmp(de->d_name, ".hund-j", 7));
+			TEST(de, "journal kept");
+			snprintf(tj, sizeof(tj), "%s/dst/%s", tdir,
+				de ? de->d_name : "");
+			closedir(d);
+			const int jfd = open(tj, O_WRONLY | O_APPEND);
+			TEST(write(jfd, "o 1048576 b", 12) == 12, "");
+			close(jfd);
+			continue;
+		}
+		while (t.ts == TS_RUNNING) {
+			task_do(&t, task_action_copyremove, TS_FINISHED);
+		}
+		TESTVAL(t.ts, TS_FINISHED, "");
+		TESTVAL(t.size_moved, jsz[1] - 1048576, "resumed from journal");
+		TESTVAL(t.size_done, jsz[0] + jsz[1], "");
+		TEST(access(tj, F_OK), "journal removed when done");
+		task_clean(&t);
+	}
+	for (int k = 0; k < 2; ++k) {
+		snprintf(tsf, sizeof(tsf), "%s/src/j/%c", tdir, 'a'+k);
+		snprintf(tdf, sizeof(tdf), "%s/dst/%c", tdir, 'a'+k);
+		TEST(_samefile(tsf, tdf), "");
+		unlink(tsf);
+		unlink(tdf);
+	}
+	rmdir(tsj);
+	const char* const mvn[] = { "x", "x/f", "x/s", "x/s/g", "y" }; // Dirs even
+	ino_t mvi[5];
+	for (int k = 0; k < 5; ++k) {
+		snprintf(tsf, sizeof(tsf), "%s/src/%s", tdir, mvn[k]);
+		TEST(k % 2 ? _mkfile(tsf, 1000) : !mkdir(tsf, 0755), "");
+	}
+	S.arr = NULL;
+	S.len = 0;
+	list_push(&S, "x", -1);
+	list_push(&S, "y", -1);
+	task_new(&t, TASK_MOVE, 0, tsrc, tdst, &S, &R);
+	while (t.ts == TS_ESTIMATE) {
+		task_do(&t, task_action_estimate, TS_CONFIRM);
+	}
+	TESTVAL(t.mv.nmp, 0, "no mount points");
+	/* As if x/s was mounted from elsewhere */
+	snprintf(tsf, sizeof(tsf), "%s/src/x/s", tdir);
+	struct stat mvs;
+	TEST(!stat(tsf, &mvs), "");
+	t.mv.mp = malloc(sizeof(struct mount_point));
+	t.mv.mp[0].path = strdup(tsf);
+	t.mv.mp[0].dev = mvs.st_dev + 1;
+	t.mv.nmp = 1;
+	for (int k = 0; k < 5; ++k) {
+		snprintf(tsf, sizeof(tsf), "%s/src/%s", tdir, mvn[k]);
+		TEST(!stat(tsf, &mvs), "");
+		mvi[k] = mvs.st_ino;
+	}
+	t.ts = TS_RUNNING;
+	while (t.ts == TS_RUNNING) {
+		task_do(&t, task_action_copyremove, TS_FINISHED);
+	}
+	TESTVAL(t.ts, TS_FINISHED, "moved");
+	TESTVAL(t.files_done, 2, "");
+	TESTVAL(t.dirs_done, 3, "");
+	TESTVAL(t.size_done, t.size_total, "");
+	const bool mvr[] = { false, true, false, false, true };
+	for (int k = 4; k >= 0; --k) {
+		snprintf(tsf, sizeof(tsf), "%s/src/%s", tdir, mvn[k]);
+		snprintf(tdf, sizeof(tdf), "%s/dst/%s", tdir, mvn[k]);
+		TEST(access(tsf, F_OK) && !stat(tdf, &mvs), "");
+		TEST((mvs.st_ino == mvi[k]) == mvr[k],
+			"renamed only what has no mount point inside");
+		TEST(k % 2 ? !unlink(tdf) : !rmdir(tdf), "");
+	}
+	task_clean(&t);
+	/* v/s/h is another link to v/a */
+	const char* const vn[] = { "v", "v/a", "v/s", "v/s/b", "v/t", "v/t/c" };
+	const size_t vsz[] = { 0, 1000, 0, 3000, 0, 500 };
+	for (int k = 0; k < 6; ++k) {
+		snprintf(tsf, sizeof(tsf), "%s/src/%s", tdir, vn[k]);
+		TEST(vsz[k] ? _mkfile(tsf, vsz[k]) : !mkdir(tsf, 0755), "");
+	}
+	snprintf(tsf, sizeof(tsf), "%s/src/v/a", tdir);
+	snprintf(tdf, sizeof(tdf), "%s/src/v/s/h", tdir);
+	TEST(!link(tsf, tdf), "");
+	off_t vsize = 0;
+	blkcnt_t vblocks = 0;
+	for (int k = 0; k < 6; ++k) {
+		snprintf(tsf, sizeof(tsf), "%s/src/%s", tdir, vn[k]);
+		TEST(!lstat(tsf, &mvs), "");
+		vsize += mvs.st_size;
+		vblocks += mvs.st_blocks;
+	}
+	S.arr = NULL;
+	S.len = 0;
+	list_push(&S, "v", -1);
+	struct volume_pool* vp = NULL;
+	struct dir_volume dv;
+	TESTVAL(volume_start(&vp, tsrc, &S), 0, "");
+	while (vp && !volume_take(vp, &dv, 1)) usleep(1000);
+	TEST(vp && volume_finished(vp), "");
+	volume_end(&vp);
+	list_free(&S);
+	TESTVAL(dv.err, 0, "");
+	TESTVAL(dv.size, vsize, "hardlink counted once");
+	TESTVAL(dv.blocks, vblocks, "");
+	struct panel vf;
+	memset(&vf, 0, sizeof(struct panel));
+	vf.wdlen = strnlen(tsrc, PATH_MAX_LEN);
+	memcpy(vf.wd, tsrc, vf.wdlen+1);
+	vf.scending = 1;
+	vf.order[0] = KEY_SIZE;
+	TESTVAL(panel_scan_dir(&vf), 0, "");
+	panel_volumes(&vf, &dv, 1);
+	fnum_t vi = file_on_list(&vf, "v");
+	TEST(vi != (fnum_t)-1 && vf.file_list[vi]->s.st_size == vsize, "");
+	TESTVAL(panel_scan_dir(&vf), 0, "");
+	vi = file_on_list(&vf, "v");
+	TEST(vi != (fnum_t)-1 && vf.file_list[vi]->s.st_size == vsize,
+		"volume survives rescan");
+	TESTVAL(vf.nvol, 1, "");
+	vf.wdlen = strnlen(tdst, PATH_MAX_LEN);
+	memcpy(vf.wd, tdst, vf.wdlen+1);
+	TESTVAL(panel_scan_dir(&vf), 0, "");
+	TESTVAL(vf.nvol, 0, "dropped in other directory");
+	delete_file_list(&vf);
+	TEST(!unlink(tdf), "");
+	for (int k = 5; k >= 0; --k) {
+		snprintf(tsf, sizeof(tsf), "%s/src/%s", tdir, vn[k]);
+		TEST(vsz[k] ? !unlink(tsf) : !rmdir(tsf), "");
+	}
+	snprintf(tsf, sizeof(tsf), "%s/src/many", tdir);
+	TEST(!mkdir(tsf, 0755), "");
+	for (int k = 0; k < 2100; ++k) {
+		snprintf(tdf, sizeof(tdf), "%s/src/many/%d", tdir, k);
+		close(creat(tdf, 0644));
+	}
+	S.arr = NULL;
+	S.len = 0;
+	list_push(&S, "many", -1);
+	task_new(&t, TASK_REMOVE, 0, tsrc, tdst, &S, &R);
+	task_message(&t, TM_PAUSE);
+	TESTVAL(t.ts, TS_PAUSED, "estimate pauses");
+	task_resume(&t);
+	TESTVAL(t.ts, TS_ESTIMATE, "and resumes estimating");
+	t.seq = true; // Walks alone; more than one step of entries
+	pthread_mutex_lock(&t.mx);
+	TESTVAL(task_start(&t, task_action_estimate, TS_CONFIRM), 0, "");
+	t.msg = TM_PAUSE;
+	pthread_mutex_unlock(&t.mx);
+	task_join(&t);
+	TESTVAL(t.ts, TS_PAUSED, "estimating worker pauses");
+	TEST(t.files_total < 2100, "");
+	task_resume(&t);
+	TESTVAL(t.ts, TS_ESTIMATE, "");
+	while (t.ts == TS_ESTIMATE) {
+		task_do(&t, task_action_estimate, TS_CONFIRM);
+	}
+	TESTVAL(t.ts, TS_CONFIRM, "not queued before confirmation");
+	TESTVAL(t.files_total, 2100, "");
+	t.ts = TS_QUEUED;
+	task_message(&t, TM_PAUSE);
+	task_resume(&t);
+	TESTVAL(t.ts, TS_QUEUED, "confirmed task resumes to queue");
+	task_clean(&t);
+	for (int k = 0; k < 2100; ++k) {
+		snprintf(tdf, sizeof(tdf), "%s/src/many/%d", tdir, k);
+		unlink(tdf);
+	}
+	TEST(!rmdir(tsf), "");
+	snprintf(tsf, sizeof(tsf), "%s/src/f", tdir);
+	snprintf(tdf, sizeof(tdf), "%s/dst/f", tdir);
+	t.ts = TS_PAUSED;
+	task_message(&t, TM_ABORT);
+	TESTVAL(t.ts, TS_FINISHED, "abort when worker is not running");
+	task_end(&t);
+
+	static struct task_queue q;
+	struct task* qt[4];
+	TESTVAL(task_queue_init(&q), 0, "");
+	const char* const qn[] = { "f", "f", "g", "src" };
+	const enum task_type qtt[] = {
+		TASK_COPY, TASK_REMOVE, TASK_REMOVE, TASK_REMOVE
+	};
+	char* const qd[] = { tsrc, tdst, tdst, tdir };
+	for (int k = 0; k < 4; ++k) {
+		S.arr = NULL;
+		S.len = 0;
+		list_push(&S, qn[k], -1);
+		qt[k] = task_queue_add(&q);
+		task_new(qt[k], qtt[k], 0, qd[k], tdst, &S, &R);
+	}
+	TEST(task_overlap(qt[0], qt[1]), "remove of copied file");
+	TEST(!task_overlap(qt[0], qt[2]), "");
+	TEST(task_overlap(qt[0], qt[3]), "remove of copied directory");
+	struct task* ot[2];
+	const char* const on[2][2] = { { "x", "ab" }, { "x-y", "x/z" } };
+	for (int k = 0; k < 2; ++k) {
+		S.arr = NULL;
+		S.len = 0;
+		list_push(&S, on[k][0], -1);
+		list_push(&S, on[k][1], -1);
+		ot[k] = task_queue_add(&q);
+		task_new(ot[k], (k ? TASK_REMOVE : TASK_COPY), 0,
+			tsrc, tdst, &S, &R);
+	}
+	TEST(task_overlap(ot[0], ot[1]), "remove inside copied directory");
+	list_free(&ot[1]->sources);
+	list_push(&ot[1]->sources, "x-y", -1);
+	list_push(&ot[1]->sources, "a", -1);
+	TEST(!task_overlap(ot[0], ot[1]), "names that only share a prefix");
+	ot[0]->ts = ot[1]->ts = TS_CLEAN;
+	qt[3]->ts = TS_CLEAN;
+	task_queue_drop(&q);
+	TESTVAL(q.n, 3, "");
+	TEST(task_queue_next(&q) == NULL, "nothing confirmed yet");
+	for (int k = 0; k < 3; ++k) qt[k]->ts = TS_QUEUED;
+	TEST(task_queue_next(&q) == qt[0], "");
+	TEST(task_queue_next(&q) == NULL, "same devices, same file");
+	qt[2]->dev[1] += 1;
+	TEST(task_queue_next(&q) == qt[2], "other devices");
+	task_queue_move(&q, 1, -1);
+	TEST(&q.t[q.o[0]] == qt[1], "reordered");
+	TEST(task_queue_next(&q) == NULL, "started task holds its files");
+	task_clean(qt[0]);
+	task_queue_drop(&q);
+	/* Worker is held on mx after its first step, so it stays busy */
+	qt[2]->ts = TS_ESTIMATE;
+	pthread_mutex_lock(&qt[2]->mx);
+	TESTVAL(task_start(qt[2], task_action_estimate, TS_CONFIRM), 0, "");
+	q.max = 1;
+	TEST(task_queue_next(&q) == NULL, "limit; busy task is running");
+	q.max = 2;
+	TEST(task_queue_next(&q) == qt[1], "");
+	pthread_mutex_unlock(&qt[2]->mx);
+	task_join(qt[2]);
+	TEST(!qt[2]->busy, "");
+	task_queue_end(&q);
+	unlink(tdf);
+	unlink(tsf);
+	rmdir(tdst);
+	rmdir(tsrc);
+	rmdir(tdir);
+
 	END_SECTION("task");
 
 
@@ -544,7 +1148,7 @@ int main() {
 	TESTVAL(ab.capacity, 100, "");
 
 	fill(&ab, ' ', 1);
-	TESTVAL(ab.capacity, 100+APPEND_BUFFER_INC, "");
+	TESTVAL(ab.capacity, 2*100, "grows geometrically");
 
 	free(ab.buf);
 	memset(&ab, 0, sizeof(struct append_buffer));
@@ -554,7 +1158,167 @@ int main() {
 	TESTVAL(ab.capacity, APPEND_BUFFER_INC, "");
 	append(&ab, "?", 1);
 	TESTVAL(ab.capacity, APPEND_BUFFER_INC*2, "");
+	free(ab.buf);
+
+	struct grid G;
+	memset(&G, 0, sizeof(struct grid));
+	memset(&ab, 0, sizeof(struct append_buffer));
+	grid_resize(&G, 2, 4);
+	grid_goto(&G, 0, 0);
+	TESTVAL(grid_put(&G, "ab", 2), 2, "");
+	grid_eol(&G);
+	TESTVAL(G.y, 1, "");
+	TEST(grid_flush(&G, &ab) > 2, "full redraw");
+	TEST(!memcmp(ab.buf+ab.top-2, "ab", 2), "");
+	ab.top = 0;
+	TESTVAL(grid_flush(&G, &ab), 0, "nothing changed");
+
+	grid_goto(&G, 0, 1);
+	grid_put(&G, "x", 1);
+	TESTVAL(grid_flush(&G, &ab), 7, "");
+	TEST(!memcmp(ab.buf, "\x1b[1;2Hx", 7), "only changed cell");
+	ab.top = 0;
+
+	grid_goto(&G, 1, 0);
+	G.xe = 3;
+	TESTVAL(grid_put(&G, "\xe6\x97\xa5\xe6\x9c\xac", 6), 6, "");
+	TESTVAL(G.x, 3, "wide glyph does not cross xe");
+	TESTSTR(G.C[1*4+2].g, " ", "padded");
+	TESTVAL(grid_flush(&G, &ab), 5, "");
+	TEST(!memcmp(ab.buf, "\r\n\xe6\x97\xa5", 5), "");
+	ab.top = 0;
+
+	grid_goto(&G, 0, 0);
+	grid_attr(&G, ATTR_BOLD, NULL);
+	grid_attr(&G, ATTR_UNDERLINE, NULL);
+	grid_put(&G, "a", 1);
+	grid_attr(&G, ATTR_NOT_UNDERLINE, NULL);
+	grid_attr(&G, ATTR_RED|ATTR_FOREGROUND, NULL);
+	grid_put(&G, "b", 1);
+	grid_attr(&G, ATTR_NORMAL, NULL);
+	grid_put(&G, "c", 1);
+	grid_flush(&G, &ab);
+	TEST(!memcmp(ab.buf, "\x1b[1H\x1b[1;4ma\x1b[24;31mb\x1b[0mc",
+			4+6+1+8+1+4+1), "only changed attributes");
+
+	const unsigned long ga = G.allocs;
+	grid_resize(&G, 1, 4);
+	grid_resize(&G, 2, 4);
+	TESTVAL(G.allocs, ga, "capacity is retained");
+
+	static const char rows[] = "abcdefghijklmnopqrst";
+	grid_resize(&G, 5, 20);
+	for (int y = 0; y < 5; ++y) {
+		grid_goto(&G, y, 0);
+		grid_put(&G, rows+y, 20-y);
+		grid_eol(&G);
+	}
+	ab.top = 0;
+	grid_flush(&G, &ab);
+	for (int y = 1; y < 4; ++y) {
+		grid_goto(&G, y, 0);
+		grid_put(&G, rows+y+1, 20-y-1);
+		grid_eol(&G);
+	}
+	ab.top = 0;
+	grid_scroll(&G, 1, 3, 0, 19, 1);
+	grid_flush(&G, &ab);
+	TEST(!memcmp(ab.buf, "\x1b[2;4r\x1b[1S\x1b[r", 13), "scrolled");
+	TESTVAL(ab.top, 13+4+16, "only exposed line is drawn");
+	TEST(!memcmp(G.S+1*20, G.C+1*20, 20*sizeof(struct cell)), "");
+	ab.top = 0;
+	grid_scroll(&G, 1, 3, 0, 19, 1);
+	TESTVAL(grid_flush(&G, &ab), 0, "nothing to scroll");
+	grid_free(&G);
+	free(ab.buf);
+
+	int sigs = 0, ticks = 0;
+	int pfd[2];
+	TESTVAL(loop_init(), 0, "");
+	TESTVAL(loop_wait(-1, 0), 0, "nothing happened");
+	TESTVAL(loop_signal(SIGUSR1, _count, &sigs), 0, "");
+	kill(getpid(), SIGUSR1);
+	TESTVAL(sigs, 0, "callback does not run in signal handler");
+	TESTVAL(loop_wait(-1, -1), 0, "");
+	TESTVAL(sigs, 1, "signal delivered through the loop");
+	const int tm = loop_timer(1, _count, &ticks);
+	TEST(tm != -1, "");
+	TESTVAL(loop_wait(-1, -1), 0, "");
+	TESTVAL(ticks, 1, "timer fired");
+	loop_timer_stop(tm);
+	TEST(!pipe(pfd), "");
+	TESTVAL(write(pfd[1], "x", 1), 1, "");
+	TESTVAL(loop_wait(pfd[0], -1), 1, "fd is readable");
+	close(pfd[0]);
+	close(pfd[1]);
+	loop_end();
+
+	struct input K;
+	const int stdin_fd = dup(STDIN_FILENO);
+	TEST(!pipe(pfd) && dup2(pfd[0], STDIN_FILENO) != -1, "");
+	static const char keys[] = "a\xc5\xbc\x1b[A\x1b[3~\x1b[1;5Ab\x7f\x03";
+	TESTVAL(write(pfd[1], keys, sizeof(keys)-1), sizeof(keys)-1, "");
+	K = get_input(-1);
+	TEST(K.t == I_UTF8 && !strcmp(K.utf, "a"), "");
+	TEST(input_pending(), "everything was read at once");
+	K = get_input(-1);
+	TEST(K.t == I_UTF8 && !strcmp(K.utf, "\xc5\xbc"), "");
+	TESTVAL(get_input(-1).t, I_ARROW_UP, "");
+	TESTVAL(get_input(-1).t, I_DELETE, "");
+	TESTVAL(get_input(-1).t, I_NONE, "unknown sequence is skipped whole");
+	K = get_input(-1);
+	TEST(K.t == I_UTF8 && !strcmp(K.utf, "b"), "");
+	TESTVAL(get_input(-1).t, I_BACKSPACE, "");
+	K = get_input(-1);
+	TEST(K.t == I_CTRL && K.utf[0] == 'C', "");
+	TEST(!input_pending(), "");
+	TESTVAL(write(pfd[1], "\x1b", 1), 1, "");
+	TESTVAL(get_input(-1).t, I_ESCAPE, "lone ESC after timeout");
+	TESTVAL(write(pfd[1], "\x1b[", 2), 2, "");
+	TESTVAL(write(pfd[1], "B", 1), 1, "");
+	TESTVAL(get_input(-1).t, I_ARROW_DOWN, "");
+	TESTVAL(get_input(0).t, I_NONE, "no input");
+	dup2(stdin_fd, STDIN_FILENO);
+	close(stdin_fd);
+	close(pfd[0]);
+	close(pfd[1]);
 
 	END_SECTION("terminal");
+
+	SECTION("ui");
+
+	struct ui U;
+	memset(&U, 0, sizeof(struct ui));
+	U.m = MODE_MANAGER;
+	U.timeout = -1;
+	TESTVAL(keymap_add(&U, "manager quit q q"), 0, "");
+	TESTVAL(keymap_add(&U, "manager entry_down j"), 0, "");
+	TESTVAL(keymap_add(&U, "chmod return ^X spc"), 0, "");
+	TESTVAL(keymap_add(&U, "manager nothing j"), EINVAL, "");
+	TESTVAL(keymap_add(&U, "manager quit"), EINVAL, "");
+	TESTVAL(keymap_add(&U, "manager quit a b c d"), EINVAL, "too long");
+	TESTVAL(keymap_add(&U, "manager entry_up j"), 0, "");
+	TESTVAL(U.kml, 3, "mapping replaced");
+	const int ui_stdin = dup(STDIN_FILENO);
+	TEST(!pipe(pfd) && dup2(pfd[0], STDIN_FILENO) != -1, "");
+	TESTVAL(write(pfd[1], "jqxqq", 5), 5, "");
+	TESTVAL(get_cmd(&U), CMD_ENTRY_UP, "");
+	TESTVAL(get_cmd(&U), CMD_NONE, "partial match");
+	TESTVAL(get_cmd(&U), CMD_NONE, "no match");
+	TESTVAL(get_cmd(&U), CMD_NONE, "");
+	TESTVAL(get_cmd(&U), CMD_QUIT, "");
+	U.m = MODE_CHMOD;
+	TESTVAL(write(pfd[1], "j\x18 ", 3), 3, "");
+	TESTVAL(get_cmd(&U), CMD_NONE, "other mode");
+	TESTVAL(get_cmd(&U), CMD_NONE, "");
+	TESTVAL(get_cmd(&U), CMD_RETURN, "");
+	dup2(ui_stdin, STDIN_FILENO);
+	close(ui_stdin);
+	close(pfd[0]);
+	close(pfd[1]);
+	free(U.kmap);
+	free(U.kt);
+
+	END_SECTION("ui");
 	END_TESTS;
 }
@@ -40,49 +40,52 @@ static enum theme_element mode2theme(const mode_t m) {
 
 struct ui* global_i;
 
-static int setup_signals(void);
+/*
+ * Signals come through the event loop,
+ * so it is safe to draw from here
+ */
+static bool _sigquit(int sig, void* data) {
+	(void)(sig);
+	((struct ui*)data)->run = false; // TODO
+	return true;
+}
 
-static void sighandler(int sig) {
-	switch (sig) {
-	case SIGTERM:
-	case SIGINT:
-		global_i->run = false; // TODO
-		break;
-	case SIGTSTP:
-		stop_raw_mode(&global_i->T);
-		signal(SIGTSTP, SIG_DFL);
-		kill(getpid(), SIGTSTP);
-		break;
-	case SIGCONT:
-		start_raw_mode(&global_i->T);
-		global_i->dirty |= DIRTY_ALL;
-		ui_draw(global_i);
-		setup_signals();
-		break;
-	case SIGWINCH:
-		for (int b = 0; b < BUF_NUM; ++b) {
-			free(global_i->B[b].buf);
-			global_i->B[b].top = global_i->B[b].capacity = 0;
-			global_i->B[b].buf = NULL;
-		}
-		global_i->dirty |= DIRTY_ALL;
-		ui_draw(global_i);
-		break;
-	default:
-		break;
-	}
+static bool _sigtstp(int sig, void* data) {
+	struct ui* const i = data;
+	stop_raw_mode(&i->T);
+	signal(sig, SIG_DFL);
+	kill(getpid(), sig);
+	/* Stopped here until SIGCONT */
+	loop_signal(sig, _sigtstp, i);
+	return false;
 }
 
-static int setup_signals(void) {
-	struct sigaction sa;
-	memset(&sa, 0, sizeof(struct sigaction));
-	sa.sa_handler = sighandler;
-	if (sigaction(SIGTERM, &sa, NULL)
-	|| sigaction(SIGINT, &sa, NULL)
-	|| sigaction(SIGTSTP, &sa, NULL)
-	|| sigaction(SIGCONT, &sa, NULL)
-	|| sigaction(SIGWINCH, &sa, NULL)) {
-		return errno;
+static bool _sigcont(int sig, void* data) {
+	struct ui* const i = data;
+	(void)(sig);
+	start_raw_mode(&i->T);
+	ui_invalidate(i);
+	ui_draw(i);
+	return false;
+}
+
+static bool _sigwinch(int sig, void* data) {
+	struct ui* const i = data;
+	(void)(sig);
+	ui_invalidate(i);
+	ui_draw(i);
+	return false;
+}
+
+static int setup_signals(struct ui* const i) {
+	int err;
+	if ((err = loop_init())
+	|| (err = loop_signal(SIGTERM, _sigquit, i))
+	|| (err = loop_signal(SIGINT, _sigquit, i))
+	|| (err = loop_signal(SIGTSTP, _sigtstp, i))
+	|| (err = loop_signal(SIGCONT, _sigcont, i))
+	|| (err = loop_signal(SIGWINCH, _sigwinch, i))) {
+		return err;
 	}
 	return 0;
 }
@@ -100,7 +103,14 @@ void ui_init(struct ui* const i, struct panel* const pv,
 	i->prompt = NULL;
 	i->prompt_cursor_pos = i->timeout = -1;
 
-	memset(i->B, 0, BUF_NUM*sizeof(struct append_buffer));
+	memset(&i->G, 0, sizeof(struct grid));
+	memset(&i->out, 0, sizeof(struct append_buffer));
+	memset(&i->os, 0, sizeof(struct output_stats));
+	i->sync = i->cursor = i->nocache = i->journal = false;
+	i->uring = true;
+	i->ptop[0] = i->ptop[1] = 0;
+	i->pfl[0] = i->pfl[1] = NULL;
+	i->rk[0] = i->rk[1] = NULL;
 	i->dirty = DIRTY_ALL;
 
 	i->fvs[0] = i->pv = pv;
@@ -111,7 +121,10 @@ void ui_init(struct ui* const i, struct panel* const pv,
 	for (size_t k = 0; k < i->kml; ++k) {
 		memcpy(&i->kmap[k], &default_mapping[k], sizeof(struct input2cmd));
 	}
-	memset(i->K, 0, sizeof(struct input)*INPUT_LIST_LENGTH);
+	i->kt = NULL;
+	i->kn = 0;
+	keymap_compile(i);
+	i->ahead = CMD_NONE;
 
 	i->perm[0] = i->perm[1] = 0;
 	i->o[0] = i->o[1] = 0;
@@ -119,7 +132,7 @@ void ui_init(struct ui* const i, struct panel* const pv,
 
 	global_i = i;
 	int err;
-		if ((err = start_raw_mode(&i->T)) || (err = setup_signals())) {
+		if ((err = start_raw_mode(&i->T)) || (err = setup_signals(i))) {
 		fprintf(stderr, "failed to initalize screen: (%d) %s\n",
 				err, strerror(err));
 		exit(EXIT_FAILURE);
@@ -128,24 +141,28 @@ void ui_init(struct ui* const i, struct panel* const pv,
 }
 
 void ui_end(struct ui* const i) {
+	output_nonblock(false);
 	write(STDOUT_FILENO, CSI_CLEAR_ALL);
 	write(STDOUT_FILENO, CSI_CURSOR_SHOW);
-	for (int b = 0; b < BUF_NUM; ++b) {
-		if (i->B[b].buf) free(i->B[b].buf);
-	}
+	grid_free(&i->G);
+	free(i->out.buf);
+	free(i->rk[0]);
+	free(i->rk[1]);
 	int err;
 	if ((err = stop_raw_mode(&i->T))) {
 		fprintf(stderr, "failed to deinitalize screen: (%d) %s\n",
 				err, strerror(err));
 		exit(EXIT_FAILURE);
 	}
+	loop_end();
 	free(i->kmap);
+	free(i->kt);
 	memset(i, 0, sizeof(struct ui));
 }
 
-void ui_pathbar(struct ui* const i, struct append_buffer* const ab) {
-	append(ab, CSI_CLEAR_LINE);
-	append_theme(ab, THEME_PATHBAR);
+void ui_pathbar(struct ui* const i, struct grid* const g) {
+	grid_goto(g, 0, 0);
+	grid_theme(g, THEME_PATHBAR);
 	for (size_t j = 0; j < 2; ++j) {
 		const int p = prettify_path_i(i->fvs[j]->wd);
 		const int t = p ? 1 : 0;
@@ -153,22 +170,22 @@ void ui_pathbar(struct ui* const i, struct append_buffer* const ab) {
 		const size_t wdw = utf8_width(wd) + t;
 		const size_t rem = i->pw[j]-2;
 		size_t padding, wdl;
-		fill(ab, ' ', 1);
+		grid_fill(g, ' ', 1);
 		if (wdw > rem) {
 			padding = 0;
 			wd += utf8_w2nb(wd, wdw - rem) - t;
 			wdl = utf8_w2nb(wd, rem);
 		}
 		else {
-			if (t) fill(ab, '~', 1);
+			if (t) grid_fill(g, '~', 1);
 			padding = rem - wdw;
 			wdl = i->fvs[j]->wdlen - p + t;
 		}
-		append(ab, wd, wdl);
-		fill(ab, ' ', 1+padding);
+		grid_put(g, wd, wdl);
+		grid_fill(g, ' ', 1+padding);
 	}
-	append_attr(ab, ATTR_NORMAL, NULL);
-	append(ab, "\r\n", 2);
+	grid_attr(g, ATTR_NORMAL, NULL);
+	grid_eol(g);
 }
 
 static size_t stringify_p(const mode_t m, char* const perms) {
@@ -204,11 +221,11 @@ static size_t stringify_g(const gid_t g, char* const group) {
 }
 
 static void _column(const enum column C, const struct file* const cfr,
-		char* const buf, const size_t bufsize, size_t* const buflen) {
+		const time_t t, char* const buf, const size_t bufsize,
+		size_t* const buflen, time_t* const until) {
 	// TODO adjust width of columns
 	// TODO inode, longsize, shortsize: length may be very different
 	struct tm T;
-	time_t t;
 	const char* tfmt;
 	time_t tspec;
 	switch (C) {
@@ -274,15 +291,16 @@ static void _column(const enum column C, const struct file* const cfr,
 	case COL_SHORTATIME:
 	case COL_SHORTCTIME:
 	case COL_SHORTMTIME:
-		t = time(NULL);
 		if (t - tspec > 60*60*24*365) {
 			tfmt = "%y'%b";
 		}
 		else if (t - tspec > 60*60*24) {
 			tfmt = "%b %d";
+			*until = tspec + 60*60*24*365 + 1;
 		}
 		else {
 			tfmt = " %H:%M";
+			*until = tspec + 60*60*24 + 1;
 		}
 		if (!localtime_r(&tspec, &T)) {
 			memset(&T, 0, sizeof(struct tm));
@@ -297,27 +315,54 @@ static void _column(const enum column C, const struct file* const cfr,
 	}
 }
 
+static const struct file_cache* _cache(struct file* const cfr,
+		const enum column col, const time_t now) {
+	struct file_cache* c = cfr->c;
+	if (c && c->col == col
+	&& c->ct.tv_sec == cfr->s.st_ctim.tv_sec
+	&& c->ct.tv_nsec == cfr->s.st_ctim.tv_nsec
+	&& (!c->until || now < c->until)) {
+		return c;
+	}
+	if (!c) {
+		if (!(c = malloc(sizeof(struct file_cache)+cfr->nl+1))) return NULL;
+		cfr->c = c;
+		if (cfr->nc == UTF8_UNWANTED) {
+			c->u = cut_unwanted(cfr->name, c->name, '.', cfr->nl+1);
+		}
+		else {
+			memcpy(c->name, cfr->name, cfr->nl+1);
+			c->u = 0;
+		}
+		c->nb = cfr->nl;
+		c->nw = (cfr->nc == UTF8_ASCII ? cfr->nl : utf8_width(c->name));
+	}
+	c->ct = cfr->s.st_ctim;
+	c->col = col;
+	c->until = 0;
+	_column(col, cfr, now, c->column, sizeof(c->column), &c->cl, &c->until);
+	return c;
+}
+
 static void _entry(struct ui* const i, const struct panel* const fv,
-		const size_t width, const fnum_t e) {
-	struct append_buffer* const ab = &i->B[BUF_PANELS];
+		const size_t width, const fnum_t e, const time_t now) {
+	struct grid* const g = &i->G;
 	// TODO scroll filenames that are too long to fit in the panel width
-	const struct file* const cfr = fv->file_list[e];
+	struct file* const cfr = fv->file_list[e];
+	const struct file_cache* const c = _cache(cfr, fv->column, now);
 
 	// File SYMbol
 	enum theme_element fsym = mode2theme(cfr->s.st_mode);
 
-	char name[NAME_BUF_SIZE];
-	const unsigned u = cut_unwanted(cfr->name, name, '.', NAME_BUF_SIZE);
-
-	char column[48];
-	size_t cl;
-	_column(fv->column, cfr, column, sizeof(column), &cl);
-
-	if (1+(fv->column != COL_NONE)+cl+1 > width) return;
+	if (!c || 1+(fv->column != COL_NONE)+c->cl+1 > width) {
+		grid_fill(g, ' ', width);
+		return;
+	}
+	const size_t cl = c->cl;
 	const size_t name_allowed = width - (1+(fv->column != COL_NONE)+cl+1);
-	const size_t name_width = utf8_width(name);
-	const size_t name_draw = (name_width < name_allowed
-			? name_width : name_allowed);
+	const size_t name_draw = (c->nw < name_allowed ? c->nw : name_allowed);
+	const size_t name_len = (c->nw < name_allowed
+			? c->nb : utf8_w2nb(c->name, name_draw));
 
 	char open = file_symbols[fsym];
 	char close = ' ';
@@ -331,25 +376,25 @@ static void _entry(struct ui* const i, const struct panel* const fv,
 			fsym += 1;
 		}
 		else {
-			append_attr(ab, ATTR_UNDERLINE, NULL);
+			grid_attr(g, ATTR_UNDERLINE, NULL);
 		}
 	}
 	if (cfr->selected) {
 		open = '[';
 		close = ']';
-		append_attr(ab, ATTR_BOLD, NULL);
-	}
-	append_theme(ab, fsym);
-	fill(ab, open, 1);
-	append(ab, name, utf8_w2nb(name, name_draw));
-	fill(ab, ' ', width - (1+name_draw+cl+1));
-	append(ab, column, cl);
-	if (u) {
+		grid_attr(g, ATTR_BOLD, NULL);
+	}
+	grid_theme(g, fsym);
+	grid_fill(g, open, 1);
+	grid_put(g, c->name, name_len);
+	grid_fill(g, ' ', width - (1+name_draw+cl+1));
+	grid_put(g, c->column, cl);
+	if (c->u) {
 		close = '*';
-		append_attr(ab, ATTR_YELLOW|ATTR_BOLD|ATTR_FOREGROUND, NULL);
+		grid_attr(g, ATTR_YELLOW|ATTR_BOLD|ATTR_FOREGROUND, NULL);
 	}
-	fill(ab, close, 1);
-	append_attr(ab, ATTR_NORMAL, NULL);
+	grid_fill(g, close, 1);
+	grid_attr(g, ATTR_NORMAL, NULL);
 }
 
 /*
@@ -398,7 +443,7 @@ static fnum_t _start_search_index(const struct panel* const s,
 	return bi;
 }
 
-void ui_statusbar(struct ui* const i, struct append_buffer* const ab) {
+void ui_statusbar(struct ui* const i, struct grid* const g) {
 	// TODO now that there are columns...
 	const struct file* const _hfr = hfr(i->pv);
 	struct tm T;
@@ -427,35 +472,36 @@ void ui_statusbar(struct ui* const i, struct append_buffer* const ab) {
 	const size_t uw = utf8_width(i->user);
 	const size_t gw = utf8_width(i->group);
 	const size_t sw = uw+1+gw+1+10+1+TIME_SIZE+1;
-	append_theme(ab, THEME_STATUSBAR);
-	fill(ab, ' ', 1);
+	grid_goto(g, 1+i->ph+i->tln, 0);
+	grid_theme(g, THEME_STATUSBAR);
+	grid_fill(g, ' ', 1);
 	if ((size_t)i->scrw < cw+sw) {
-		fill(ab, ' ', i->scrw-1);
-		append_attr(ab, ATTR_NORMAL, NULL);
-		append(ab, "\r\n", 2);
+		grid_fill(g, ' ', i->scrw-1);
+		grid_attr(g, ATTR_NORMAL, NULL);
+		grid_eol(g);
 		return;
 	}
-	append(ab, S, sl);
-	fill(ab, ' ', i->scrw-cw-sw); // Padding
-	append(ab, i->user, strnlen(i->user, LOGIN_MAX_LEN));
-	fill(ab, ' ', 1);
-	append(ab, i->group, strnlen(i->group, LOGIN_MAX_LEN));
-	fill(ab, ' ', 1);
-	append(ab, &i->perms[0], 1);
+	grid_put(g, S, sl);
+	grid_fill(g, ' ', i->scrw-cw-sw); // Padding
+	grid_put(g, i->user, strnlen(i->user, LOGIN_MAX_LEN));
+	grid_fill(g, ' ', 1);
+	grid_put(g, i->group, strnlen(i->group, LOGIN_MAX_LEN));
+	grid_fill(g, ' ', 1);
+	grid_put(g, &i->perms[0], 1);
 	for (size_t p = 1; p < 10; ++p) {
 		const mode_t m[2] = {
 			(i->perm[0] & 0777) & (0400 >> (p-1)),
 			(i->perm[1] & 0777) & (0400 >> (p-1))
 		};
-		if (m[0] != m[1]) append_attr(ab, ATTR_UNDERLINE, NULL);
-		append(ab, &i->perms[p], 1);
-		if (m[0] != m[1]) append_attr(ab, ATTR_NOT_UNDERLINE, NULL);
+		if (m[0] != m[1]) grid_attr(g, ATTR_UNDERLINE, NULL);
+		grid_put(g, &i->perms[p], 1);
+		if (m[0] != m[1]) grid_attr(g, ATTR_NOT_UNDERLINE, NULL);
 	}
-	fill(ab, ' ', 1);
-	append(ab, i->time, strnlen(i->time, TIME_SIZE));
-	fill(ab, ' ', 1);
-	append_attr(ab, ATTR_NORMAL, NULL);
-	append(ab, "\r\n", 2);
+	grid_fill(g, ' ', 1);
+	grid_put(g, i->time, strnlen(i->time, TIME_SIZE));
+	grid_fill(g, ' ', 1);
+	grid_attr(g, ATTR_NORMAL, NULL);
+	grid_eol(g);
 }
 
 static void _keyname(const struct input* const in, char* const buf) {
@@ -509,9 +555,10 @@ static void _keyname(const struct input* const in, char* const buf) {
 
 inline static void _find_all_keyseqs4cmd(const struct ui* const i,
 		const enum command c, const enum mode m,
-		const struct input2cmd* ic[], size_t* const ki) {
+		const struct input2cmd* ic[], size_t* const ki,
+		const size_t max) {
 	*ki = 0;
-	for (size_t k = 0; k < i->kml; ++k) {
+	for (size_t k = 0; k < i->kml && *ki < max; ++k) {
 		if (i->kmap[k].c != c || i->kmap[k].m != m) continue;
 		ic[*ki] = &i->kmap[k];
 		*ki += 1;
@@ -535,7 +582,7 @@ int help_to_fd(struct ui* const i, const int tmpfd) {
 		const struct input2cmd* k[4];
 		size_t ki = 0;
 		for (size_t c = CMD_NONE+1; c < CMD_NUM; ++c) {
-			_find_all_keyseqs4cmd(i, c, m, k, &ki);
+			_find_all_keyseqs4cmd(i, c, m, k, &ki, 4);
 			if (!ki) continue; // ^^^ may output empty array
 			size_t maxsequences = 4;
 			char key[KEYNAME_BUF_SIZE];
@@ -574,34 +621,100 @@ int help_to_fd(struct ui* const i, const int tmpfd) {
 	return err;
 }
 
-void ui_panels(struct ui* const i, struct append_buffer* const ab) {
+/*
+ * Number of visible entries between a and b
+ * Negative if b is before a
+ */
+static int _rows_between(const struct panel* const fv,
+		const fnum_t a, const fnum_t b) {
+	const fnum_t l = (a < b ? a : b);
+	const fnum_t h = (a < b ? b : a);
+	int n = 0;
+	for (fnum_t f = l; f < h && f < fv->num_files; ++f) {
+		n += visible(fv, f);
+	}
+	return (a < b ? n : -n);
+}
+
+void ui_panels(struct ui* const i, struct grid* const g) {
 	fnum_t e[2] = {
 		_start_search_index(i->fvs[0], i->fvs[0]->num_hidden, i->ph-1),
 		_start_search_index(i->fvs[1], i->fvs[1]->num_hidden, i->ph-1),
 	};
+	for (size_t p = 0; p < 2; ++p) {
+		const struct panel* const fv = i->fvs[p];
+		if (fv->file_list == i->pfl[p] && e[p] != i->ptop[p]) {
+			const int n = _rows_between(fv, i->ptop[p], e[p]);
+			grid_scroll(g, 1, i->ph, i->pxoff[p],
+				i->pxoff[p]+i->pw[p]-1, n);
+		}
+		i->ptop[p] = e[p];
+		i->pfl[p] = fv->file_list;
+	}
+	const time_t now = time(NULL);
 	for (int L = 0; L < i->ph; ++L) {
-		append(ab, CSI_CLEAR_LINE);
 		for (size_t p = 0; p < 2; ++p) {
-			const fnum_t nf = i->fvs[p]->num_files;
-			while (e[p] < nf && !visible(i->fvs[p], e[p])) {
+			const struct panel* const fv = i->fvs[p];
+			const fnum_t nf = fv->num_files;
+			while (e[p] < nf && !visible(fv, e[p])) {
+				e[p] += 1;
+			}
+			struct row_key k;
+			memset(&k, 0, sizeof(struct row_key));
+			k.valid = true;
+			k.gen = fs_generation;
+			k.col = fv->column;
+			k.w = i->pw[p];
+			if (e[p] < nf) {
+				const struct file* const f = fv->file_list[e[p]];
+				const struct file_cache* const c = f->c;
+				k.f = f;
+				if (e[p] == fv->selection) {
+					k.s = RS_HIGHLIGHTED
+						| (fv == i->pv ? RS_ACTIVE : 0)
+						| (!fv->num_selected ? RS_NONE_SELECTED : 0);
+				}
+				k.s |= (f->selected ? RS_SELECTED : 0);
+				if (!c || (c->until && now >= c->until)) k.valid = false;
+			}
+			struct row_key* const rk = (i->rk[p] ? &i->rk[p][L] : NULL);
+			if (rk && k.valid && !memcmp(rk, &k, sizeof(struct row_key))) {
 				e[p] += 1;
+				continue;
 			}
+			if (rk) {
+				k.valid = true;
+				memcpy(rk, &k, sizeof(struct row_key));
+			}
+			grid_goto(g, 1+L, i->pxoff[p]);
+			g->xe = i->pxoff[p]+i->pw[p];
 			if (e[p] >= nf) {
-				append_theme(ab, THEME_OTHER);
-				fill(ab, ' ', i->pw[p]);
-				append_attr(ab, ATTR_NORMAL, NULL);
+				grid_theme(g, THEME_OTHER);
+				grid_fill(g, ' ', i->pw[p]);
+				grid_attr(g, ATTR_NORMAL, NULL);
 			}
 			else {
-				_entry(i, i->fvs[p], i->pw[p], e[p]);
+				_entry(i, fv, i->pw[p], e[p], now);
 			}
 			e[p] += 1;
 		}
-		append(ab, "\r\n", 2);
 	}
 }
 
-void ui_bottombar(struct ui* const i, struct append_buffer* const ab) {
-	append(ab, CSI_CLEAR_LINE);
+void ui_tasks(struct ui* const i, struct grid* const g) {
+	for (int r = 0; r < i->tln; ++r) {
+		grid_goto(g, 1+i->ph+r, 0);
+		grid_theme(g, (r == i->tls ? THEME_STATUSBAR : THEME_INFO));
+		const size_t w = utf8_width(i->tl[r]);
+		grid_put(g, i->tl[r], strlen(i->tl[r]));
+		if ((size_t)i->scrw > w) grid_fill(g, ' ', i->scrw-w);
+		grid_attr(g, ATTR_NORMAL, NULL);
+		grid_eol(g);
+	}
+}
+
+void ui_bottombar(struct ui* const i, struct grid* const g) {
+	grid_goto(g, 2+i->ph+i->tln, 0);
 	if (i->prompt) {
 		const size_t aw = utf8_width(i->prch);
 		const size_t pw = utf8_width(i->prompt);
@@ -612,9 +725,9 @@ void ui_bottombar(struct ui* const i, struct append_buffer* const ab) {
 		else {
 			padding = 0;
 		}
-		append(ab, i->prch, aw);
-		append(ab, i->prompt, strlen(i->prompt));
-		if (padding) fill(ab, ' ', padding);
+		grid_put(g, i->prch, aw);
+		grid_put(g, i->prompt, strlen(i->prompt));
+		if (padding) grid_fill(g, ' ', padding);
 	}
 	else if (i->mt) {
 		int cp = 0;
@@ -623,28 +736,38 @@ void ui_bottombar(struct ui* const i, struct append_buffer* const ab) {
 		case MSG_ERROR: cp = THEME_ERROR; break;
 		default: break;
 		}
-		append_theme(ab, cp);
-		append(ab, i->msg, strlen(i->msg));
-		append_attr(ab, ATTR_NORMAL, NULL);
-		fill(ab, ' ', i->scrw-utf8_width(i->msg));
+		grid_theme(g, cp);
+		grid_put(g, i->msg, strlen(i->msg));
+		grid_attr(g, ATTR_NORMAL, NULL);
 		i->mt = MSG_NONE;
 	}
 	else if (i->m == MODE_CHMOD) {
-		append(ab, "-- CHMOD --", 11);
+		grid_put(g, "-- CHMOD --", 11);
 		char p[4+1+1+4+1+1+4+1+1+4+1];
-		fill(ab, ' ', i->scrw-(sizeof(p)-1)-11);
+		grid_fill(g, ' ', i->scrw-(sizeof(p)-1)-11);
 		snprintf(p, sizeof(p), "%04o +%04o -%04o =%04o",
 				i->perm[0] & 07777, i->plus,
 				i->minus, i->perm[1] & 07777);
-		append(ab, p, sizeof(p));
+		grid_put(g, p, sizeof(p));
 	}
 	else {
 		// TODO input buffer
 	}
+	grid_eol(g);
+}
+
+static void _iov(struct iovec* const v, const void* const b, const size_t n) {
+	v->iov_base = (void*)b;
+	v->iov_len = n;
 }
 
 void ui_draw(struct ui* const i) {
-	ui_update_geometry(i);
+	const unsigned long a0 = i->out.allocs + i->G.allocs;
+	unsigned sc = 0;
+	if (i->G.full || !i->G.h) {
+		ui_update_geometry(i);
+		sc += 1;
+	}
 	if (i->m == MODE_MANAGER || i->m == MODE_WAIT) {
 		const struct file* const H = hfr(i->pv);
 		if (H) {
@@ -663,26 +786,83 @@ void ui_draw(struct ui* const i) {
 		stringify_u(i->o[1], i->user);
 		stringify_g(i->g[1], i->group);
 	}
-	write(STDOUT_FILENO, CSI_CURSOR_HIDE_TOP_LEFT);
 	for (int b = 0; b < BUF_NUM; ++b) {
 		if (i->dirty & (1 << b)) {
-			i->B[b].top = 0;
-			do_draw[b](i, &i->B[b]);
+			do_draw[b](i, &i->G);
 		}
-		write(STDOUT_FILENO, i->B[b].buf, i->B[b].top);
 	}
 	i->dirty = 0;
-	if (i->prompt && i->prompt_cursor_pos >= 0) {
-		write(STDOUT_FILENO, CSI_CURSOR_SHOW);
-		move_cursor(i->scrh, i->prompt_cursor_pos%i->scrw+1);
+
+	if (output_pending()) {
+		/* Terminal did not take previous frame yet;
+		 * what was composed will be sent with the next one */
+		const size_t p = output_drain();
+		sc += 1;
+		i->os.pending = p;
+		if (p) {
+			i->os.dropped += 1;
+			return;
+		}
+	}
+	struct append_buffer* const ab = &i->out;
+	ab->top = 0;
+	if (i->cursor) {
+		append(ab, CSI_CURSOR_HIDE);
+		i->cursor = false;
 	}
+	grid_flush(&i->G, ab);
+	if (i->prompt && i->prompt_cursor_pos >= 0 && i->scrw > 0) {
+		grid_cursor(&i->G, ab, i->scrh-1, i->prompt_cursor_pos%i->scrw);
+		append(ab, CSI_CURSOR_SHOW);
+		i->cursor = true;
+	}
+	if (!ab->top) return;
+	struct iovec iov[3];
+	int n = 0;
+	if (i->sync) _iov(&iov[n++], CSI_SYNC_BEGIN);
+	_iov(&iov[n++], ab->buf, ab->top);
+	if (i->sync) _iov(&iov[n++], CSI_SYNC_END);
+	output_frame(iov, n);
+	sc += 1;
+	i->os.frames += 1;
+	i->os.bytes = ab->top;
+	i->os.bytes_total += i->os.bytes;
+	i->os.pending = output_pending();
+	i->os.allocs = i->out.allocs + i->G.allocs - a0;
+	i->os.syscalls = sc;
+}
+
+/*
+ * Contents of the screen are unknown (external program, resize...)
+ * Next ui_draw() will draw everything from scratch
+ */
+void ui_invalidate(struct ui* const i) {
+	grid_invalidate(&i->G);
+	i->cursor = true;
+	i->dirty = DIRTY_ALL;
 }
 
 void ui_update_geometry(struct ui* const i) {
+	const int oh = i->scrh, ow = i->scrw, oph = i->ph;
 	window_size(&i->scrh, &i->scrw);
+	const bool resized = oh != i->scrh || ow != i->scrw || !i->G.h;
+	if (resized) {
+		grid_resize(&i->G, i->scrh, i->scrw);
+		i->dirty = DIRTY_ALL;
+	}
 	i->pw[0] = i->scrw/2;
 	i->pw[1] = i->scrw - i->pw[0];
-	i->ph = i->scrh - 3;
+	if (i->tln > i->scrh - 4) i->tln = (i->scrh > 4 ? i->scrh - 4 : 0);
+	i->ph = i->scrh - 3 - i->tln;
+	if (oph != i->ph) i->dirty = DIRTY_ALL;
+	if (resized || oph != i->ph) {
+		for (int p = 0; p < 2; ++p) {
+			free(i->rk[p]);
+			i->rk[p] = NULL;
+			if (i->ph > 0) i->rk[p] = calloc(i->ph, sizeof(struct row_key));
+			i->pfl[p] = NULL; // Rows moved; nothing to scroll
+		}
+	}
 	i->pxoff[0] = 0;
 	i->pxoff[1] = i->scrw/2;
 }
@@ -747,45 +927,174 @@ int ui_ask(struct ui* const i, const char* const q,
 	}
 }
 
+static bool _input_eq(const struct input* const a,
+		const struct input* const b) {
+	return a->t == b->t && !memcmp(a->utf, b->utf, sizeof(a->utf));
+}
+
+static size_t _kt_find(const struct ui* const i, size_t k,
+		const struct input* const in) {
+	for (k = i->kt[k].child; k && !_input_eq(&i->kt[k].i, in);
+			k = i->kt[k].next);
+	return k;
+}
+
+/*
+ * Builds trie out of i->kmap
+ * Must be called after i->kmap is changed
+ */
+int keymap_compile(struct ui* const i) {
+	const size_t max = MODE_NUM + i->kml*INPUT_LIST_LENGTH;
+	if (max > USHRT_MAX) return ENOMEM;
+	struct key_tnode* const kt = calloc(max, sizeof(struct key_tnode));
+	if (!kt) return ENOMEM;
+	free(i->kt);
+	i->kt = kt;
+	i->kn = 0;
+	size_t n = MODE_NUM;
+	for (size_t m = 0; m < i->kml; ++m) {
+		size_t k = i->kmap[m].m;
+		for (size_t j = 0; j < INPUT_LIST_LENGTH
+				&& i->kmap[m].i[j].t != I_NONE; ++j) {
+			size_t c = _kt_find(i, k, &i->kmap[m].i[j]);
+			if (!c) {
+				c = n++;
+				kt[c].i = i->kmap[m].i[j];
+				kt[c].next = kt[k].child;
+				kt[k].child = c;
+			}
+			k = c;
+		}
+		/* First mapping wins */
+		if (k >= MODE_NUM && kt[k].c == CMD_NONE) {
+			kt[k].c = i->kmap[m].c;
+		}
+	}
+	return 0;
+}
+
 /*
- * Find matching mappings
- * If there are a few, do nothing, wait longer.
- * If there is only one, send it.
+ * Walks keymap trie, one key per call
+ * If sequence is incomplete, do nothing, wait for more keys.
+ * If it maps to a command, send it.
  */
 enum command get_cmd(struct ui* const i) {
-#define ISIZE (sizeof(struct input)*INPUT_LIST_LENGTH)
-	int Kn = 0;
-	while (Kn < INPUT_LIST_LENGTH && i->K[Kn].t != I_NONE) {
-		Kn += 1;
-	}
-	if (Kn == INPUT_LIST_LENGTH) {
-		memset(i->K, 0, ISIZE);
-		Kn = 0;
-	}
-	i->K[Kn] = get_input(i->timeout);
-	if (i->K[Kn].t == I_NONE
-	|| i->K[Kn].t == I_ESCAPE
-	|| IS_CTRL(i->K[Kn], '[')) {
-		memset(i->K, 0, ISIZE);
+	if (i->ahead != CMD_NONE) {
+		const enum command c = i->ahead;
+		i->ahead = CMD_NONE;
+		return c;
+	}
+	const struct input in = get_input(i->timeout);
+	if (in.t == I_NONE || in.t == I_ESCAPE || IS_CTRL(in, '[')) {
+		i->kn = 0;
 		return CMD_NONE;
 	}
-	int pm = 0; // partial match
-	for (size_t m = 0; m < i->kml; ++m) {
-		if (i->kmap[m].m != i->m) continue;
-		if (!memcmp(i->K, i->kmap[m].i, ISIZE)) {
-			memset(i->K, 0, ISIZE);
-			return i->kmap[m].c;
+	const size_t k = _kt_find(i, (i->kn ? i->kn : (size_t)i->m), &in);
+	if (!k || i->kt[k].c != CMD_NONE) {
+		i->kn = 0;
+		return (k ? i->kt[k].c : CMD_NONE);
+	}
+	i->kn = k;
+	return CMD_NONE;
+}
+
+/*
+ * Parses single key name, as printed by help
+ * Returns length of name or 0
+ */
+static size_t _keyparse(const char* const s, struct input* const in) {
+	static const struct {
+		const char* n;
+		struct input in;
+	} N[] = {
+		{ "up", KSPEC(I_ARROW_UP) },
+		{ "down", KSPEC(I_ARROW_DOWN) },
+		{ "right", KSPEC(I_ARROW_RIGHT) },
+		{ "left", KSPEC(I_ARROW_LEFT) },
+		{ "home", KSPEC(I_HOME) },
+		{ "end", KSPEC(I_END) },
+		{ "pgup", KSPEC(I_PAGE_UP) },
+		{ "pgdn", KSPEC(I_PAGE_DOWN) },
+		{ "ins", KSPEC(I_INSERT) },
+		{ "bsp", KSPEC(I_BACKSPACE) },
+		{ "del", KSPEC(I_DELETE) },
+		{ "tab", KCTRL('I') },
+		{ "enter", KCTRL('M') },
+		{ "spc", KUTF8(" ") },
+	};
+	const size_t l = strcspn(s, " ");
+	memset(in, 0, sizeof(struct input));
+	for (size_t n = 0; n < sizeof(N)/sizeof(N[0]); ++n) {
+		if (strlen(N[n].n) == l && !memcmp(s, N[n].n, l)) {
+			*in = N[n].in;
+			return l;
 		}
-		bool M = true;
-		for (int t = 0; t < Kn+1; ++t) {
-			M = M && !memcmp(&i->kmap[m].i[t],
-				&i->K[t], sizeof(struct input));
+	}
+	if (l == 2 && s[0] == '^' && '@' <= s[1] && s[1] <= '_') {
+		in->t = I_CTRL;
+		in->utf[0] = s[1];
+		return l;
+	}
+	if (l && utf8_g2nb(s) == l) {
+		memcpy(in->utf, s, l);
+		if (!utf8_validate(in->utf)) return 0;
+		in->t = I_UTF8;
+		return l;
+	}
+	return 0;
+}
+
+/*
+ * map <mode> <command> <key> [key...]
+ * Keys are named as in help; sequence replaces
+ * previous mapping of the same keys in the same mode
+ */
+int keymap_add(struct ui* const i, const char* s) {
+	struct input2cmd ic;
+	memset(&ic, 0, sizeof(struct input2cmd));
+	size_t l, m, c, k = 0;
+	l = strcspn(s, " ");
+	for (m = 0; m < MODE_NUM; ++m) {
+		if (strlen(mode_names[m]) == l && !memcmp(s, mode_names[m], l)) break;
+	}
+	if (m == MODE_NUM || !s[l]) return EINVAL;
+	s += l+1;
+	l = strcspn(s, " ");
+	for (c = CMD_NONE+1; c < CMD_NUM; ++c) {
+		if (strlen(cmd_names[c]) == l && !memcmp(s, cmd_names[c], l)) break;
+	}
+	if (c == CMD_NUM) return EINVAL;
+	s += l;
+	while (*s == ' ') {
+		s += 1;
+		if (!*s) break;
+		if (k == INPUT_LIST_LENGTH-1 || !(l = _keyparse(s, &ic.i[k++]))) {
+			return EINVAL;
 		}
-		pm += M;
+		s += l;
 	}
-	if (!pm) memset(i->K, 0, ISIZE);
-	return CMD_NONE;
-#undef ISIZE
+	if (!k || *s) return EINVAL;
+	ic.m = m;
+	ic.c = c;
+	size_t e;
+	for (e = 0; e < i->kml; ++e) {
+		if (i->kmap[e].m != ic.m) continue;
+		size_t j = 0;
+		while (j < INPUT_LIST_LENGTH
+		&& _input_eq(&i->kmap[e].i[j], &ic.i[j])) {
+			j += 1;
+		}
+		if (j == INPUT_LIST_LENGTH) break;
+	}
+	if (e == i->kml) {
+		void* const tmp = realloc(i->kmap,
+				(i->kml+1)*sizeof(struct input2cmd));
+		if (!tmp) return ENOMEM;
+		i->kmap = tmp;
+		i->kml += 1;
+	}
+	i->kmap[e] = ic;
+	return keymap_compile(i);
 }
 
 /*
@@ -930,17 +1239,14 @@ int spawn(char* const arg[], const enum spawn_flags f) {
 	}
 	global_i->msg[0] = 0;
 	ret = start_raw_mode(&global_i->T);
-	global_i->dirty = DIRTY_ALL;
+	ui_invalidate(global_i);
 	ui_draw(global_i);
 	return ret;
 }
 
-size_t append_theme(struct append_buffer* const ab,
-		const enum theme_element te) {
-	size_t n = 0;
-	n += append_attr(ab, theme_scheme[te].fg | ATTR_FOREGROUND,
+void grid_theme(struct grid* const g, const enum theme_element te) {
+	grid_attr(g, theme_scheme[te].fg | ATTR_FOREGROUND,
 			theme_scheme[te].fg_color);
-	n += append_attr(ab, theme_scheme[te].bg | ATTR_BACKGROUND,
+	grid_attr(g, theme_scheme[te].bg | ATTR_BACKGROUND,
 			theme_scheme[te].bg_color);
-	return n;
 }
@@ -35,6 +35,43 @@
 #include "terminal.h"
 
 #define MSG_BUFFER_SIZE 128
+#define TASK_ROWS 8 // Task list; one row per task
+
+/*
+ * Panel row is composed again only if its key changes
+ */
+struct row_key {
+	const struct file* f; // NULL = empty row
+	unsigned long gen; // fs_generation
+	enum column col;
+	size_t w;
+	unsigned char s; // enum row_state
+	bool valid;
+};
+
+enum row_state {
+	RS_HIGHLIGHTED = 1<<0,
+	RS_ACTIVE = 1<<1, // Highlighted in the active panel
+	RS_NONE_SELECTED = 1<<2, // Highlighted, no files selected
+	RS_SELECTED = 1<<3,
+};
+
+/*
+ * What _entry() made of a file last time it was drawn
+ * Rebuilt if the column or file's ctime changes
+ * or the short time column expires (until; 0 = never)
+ */
+struct file_cache {
+	struct timespec ct;
+	time_t until;
+	enum column col;
+	size_t cl; // Column length
+	char column[48];
+	size_t nw; // Name width
+	size_t nb; // Name length in bytes
+	unsigned u; // Number of unwanted bytes in name
+	char name[]; // Sanitized
+};
 #define KEYNAME_BUF_SIZE 16
 // TODO adjust KEYNAME_BUF_SIZE
 
@@ -116,6 +153,9 @@ enum command {
 	CMD_TASK_QUIT,
 	CMD_TASK_PAUSE,
 	CMD_TASK_RESUME,
+	CMD_TASK_RAISE,
+	CMD_TASK_LOWER,
+	CMD_TASKS,
 
 	CMD_NUM,
 };
@@ -201,6 +241,7 @@ static const struct theme_attrs theme_scheme[THEME_ELEM_NUM] = {
 };
 
 #define INPUT_LIST_LENGTH 4
+#define INPUT_BURST 64 // Keys processed between two frames, at most
 
 struct input2cmd {
 	struct input i[INPUT_LIST_LENGTH];
@@ -208,6 +249,17 @@ struct input2cmd {
 	enum command c : 8;
 };
 
+/*
+ * Key mappings compiled into a prefix trie
+ * Nodes 0..MODE_NUM-1 are roots of each mode
+ * 0 as child/next means 'none'
+ */
+struct key_tnode {
+	struct input i;
+	enum command c : 8;
+	unsigned short child, next;
+};
+
 #define IS_CTRL(I,K) (((I).t == I_CTRL) && ((I).utf[0] == (K)))
 
 #define KUTF8(K) { .t = I_UTF8, .utf = K }
@@ -290,6 +342,8 @@ static struct input2cmd default_mapping[] = {
 
 	{ { KUTF8("t") }, MODE_MANAGER, CMD_COL, },
 
+	{ { KUTF8("T") }, MODE_MANAGER, CMD_TASKS, },
+
 	/* MODE CHMOD */
 	{ { KUTF8("q"), KUTF8("q") }, MODE_CHMOD, CMD_RETURN },
 	{ { KUTF8("c"), KUTF8("c") }, MODE_CHMOD, CMD_CHANGE },
@@ -308,6 +362,16 @@ static struct input2cmd default_mapping[] = {
 	{ { KUTF8("q"), KUTF8("q") }, MODE_WAIT, CMD_TASK_QUIT },
 	{ { KUTF8("p"), KUTF8("p") }, MODE_WAIT, CMD_TASK_PAUSE },
 	{ { KUTF8("r"), KUTF8("r") }, MODE_WAIT, CMD_TASK_RESUME },
+	{ { KUTF8("K") }, MODE_WAIT, CMD_TASK_RAISE },
+	{ { KUTF8("J") }, MODE_WAIT, CMD_TASK_LOWER },
+	{ { KUTF8("T") }, MODE_WAIT, CMD_TASKS },
+
+	{ { KUTF8("j") }, MODE_WAIT, CMD_ENTRY_DOWN },
+	{ { KSPEC(I_ARROW_DOWN) }, MODE_WAIT, CMD_ENTRY_DOWN },
+	{ { KUTF8("k") }, MODE_WAIT, CMD_ENTRY_UP },
+	{ { KSPEC(I_ARROW_UP) }, MODE_WAIT, CMD_ENTRY_UP },
+	{ { KUTF8("g"), KUTF8("g") }, MODE_WAIT, CMD_ENTRY_FIRST },
+	{ { KUTF8("G") }, MODE_WAIT, CMD_ENTRY_LAST },
 
 };
 
@@ -346,7 +410,7 @@ static const char* const cmd_help[] = {
 	[CMD_DUP_PANEL] = "Open current directory in the other panel",
 	[CMD_SWAP_PANELS] = "Swap panels",
 
-	[CMD_DIR_VOLUME] = "Calcualte volume of selected directory",
+	[CMD_DIR_VOLUME] = "Calculate volume of selected directories",
 	[CMD_TOGGLE_HIDDEN] = "Toggle between hiding/showing hidden files",
 
 	[CMD_SORT_REVERSE] = "Switch between ascending/descending sorting",
@@ -381,14 +445,80 @@ static const char* const cmd_help[] = {
 	[CMD_TASK_QUIT] = "Abort task",
 	[CMD_TASK_PAUSE] = "Pause task",
 	[CMD_TASK_RESUME] = "Resume task",
+	[CMD_TASK_RAISE] = "Move task up the queue",
+	[CMD_TASK_LOWER] = "Move task down the queue",
+	[CMD_TASKS] = "Show/hide task list",
+
+	[CMD_NUM] = NULL,
+};
 
+/* Names of commands and modes, as used by 'map' */
+static const char* const cmd_names[] = {
+	[CMD_QUIT] = "quit",
+	[CMD_HELP] = "help",
+	[CMD_COPY] = "copy",
+	[CMD_MOVE] = "move",
+	[CMD_REMOVE] = "remove",
+	[CMD_CREATE_DIR] = "create_dir",
+	[CMD_RENAME] = "rename",
+	[CMD_LINK] = "link",
+	[CMD_UP_DIR] = "up_dir",
+	[CMD_ENTER_DIR] = "enter_dir",
+	[CMD_ENTRY_UP] = "entry_up",
+	[CMD_ENTRY_DOWN] = "entry_down",
+	[CMD_SCREEN_UP] = "screen_up",
+	[CMD_SCREEN_DOWN] = "screen_down",
+	[CMD_ENTRY_FIRST] = "entry_first",
+	[CMD_ENTRY_LAST] = "entry_last",
+	[CMD_COMMAND] = "command",
+	[CMD_CD] = "cd",
+	[CMD_REFRESH] = "refresh",
+	[CMD_SWITCH_PANEL] = "switch_panel",
+	[CMD_DUP_PANEL] = "dup_panel",
+	[CMD_SWAP_PANELS] = "swap_panels",
+	[CMD_DIR_VOLUME] = "dir_volume",
+	[CMD_TOGGLE_HIDDEN] = "toggle_hidden",
+	[CMD_SORT_REVERSE] = "sort_reverse",
+	[CMD_SORT_CHANGE] = "sort_change",
+	[CMD_COL] = "col",
+	[CMD_SELECT_FILE] = "select_file",
+	[CMD_SELECT_ALL] = "select_all",
+	[CMD_SELECT_NONE] = "select_none",
+	[CMD_SELECTED_NEXT] = "selected_next",
+	[CMD_SELECTED_PREV] = "selected_prev",
+	[CMD_MARK_NEW] = "mark_new",
+	[CMD_MARK_JUMP] = "mark_jump",
+	[CMD_FIND] = "find",
+	[CMD_CHMOD] = "chmod",
+	[CMD_CHANGE] = "change",
+	[CMD_RETURN] = "return",
+	[CMD_CHOWN] = "chown",
+	[CMD_CHGRP] = "chgrp",
+	[CMD_A] = "a",
+	[CMD_U] = "u",
+	[CMD_G] = "g",
+	[CMD_O] = "o",
+	[CMD_PL] = "pl",
+	[CMD_MI] = "mi",
+	[CMD_TASK_QUIT] = "task_quit",
+	[CMD_TASK_PAUSE] = "task_pause",
+	[CMD_TASK_RESUME] = "task_resume",
+	[CMD_TASK_RAISE] = "task_raise",
+	[CMD_TASK_LOWER] = "task_lower",
+	[CMD_TASKS] = "tasks",
 	[CMD_NUM] = NULL,
 };
 
+static const char* const mode_names[] = {
+	[MODE_MANAGER] = "manager",
+	[MODE_CHMOD] = "chmod",
+	[MODE_WAIT] = "wait",
+};
+
 static const char* const mode_strings[] = {
 	[MODE_CHMOD] = "CHMOD",
 	[MODE_MANAGER] = "FILE VIEW",
-	[MODE_WAIT] = "WAIT",
+	[MODE_WAIT] = "TASK LIST",
 };
 
 static const char* const more_help[] = {
@@ -401,6 +531,20 @@ static const char* const more_help[] = {
 	"+x\tQuick chmod +x",
 	"sh\tOpen shell",
 	"sh ...\tExecute command in shell",
+	"stats\tShow output statistics",
+	"set sync\tSynchronized output (DEC 2026)",
+	"set nosync\tNo synchronized output",
+	"set lrmargins\tScroll panels using left/right margins (DECSLRM)",
+	"set nolrmargins\tScroll only full lines",
+	"set nocache\tCopy without filling page cache",
+	"set cache\tCopy through page cache",
+	"set journal\tJournal copies; the same copy started again resumes",
+	"set nojournal\tCopy without journal",
+	"set nouring\tCopy small files one by one",
+	"set uring\tCopy small files in batches (io_uring)",
+	"set tasks N\tRun up to N tasks at once; others wait in queue",
+	"map M C K...\tMap keys K (named as above) to command C in mode M",
+	"            \te.g. `map manager entry_down ^N`",
 	"",
 	"SORTING",
 	"+\tascending",
@@ -475,6 +619,7 @@ static const char* const timefmt = "%Y-%m-%d %H:%M:%S";
 enum {
 	BUF_PATHBAR = 0,
 	BUF_PANELS,
+	BUF_TASKS,
 	BUF_STATUSBAR,
 	BUF_BOTTOMBAR,
 	BUF_NUM
@@ -483,15 +628,18 @@ enum {
 enum dirty_flag {
 	DIRTY_PATHBAR = 1<<BUF_PATHBAR,
 	DIRTY_PANELS = 1<<BUF_PANELS,
+	DIRTY_TASKS = 1<<BUF_TASKS,
 	DIRTY_STATUSBAR = 1<<BUF_STATUSBAR,
 	DIRTY_BOTTOMBAR = 1<<BUF_BOTTOMBAR,
-	DIRTY_ALL = DIRTY_PATHBAR|DIRTY_PANELS|DIRTY_STATUSBAR|DIRTY_BOTTOMBAR,
+	DIRTY_ALL = DIRTY_PATHBAR|DIRTY_PANELS|DIRTY_TASKS
+		|DIRTY_STATUSBAR|DIRTY_BOTTOMBAR,
 };
 
 struct ui {
 	int scrh, scrw; // Last window dimensions
 	int pw[2]; // Panel Width
 	int ph; // Panel Height
+	int tln; // Task list rows; below panels
 	int pxoff[2]; // Panel X OFFset
 
 	bool run;
@@ -501,13 +649,26 @@ struct ui {
 	enum msg_type mt;
 	char msg[MSG_BUFFER_SIZE];
 
+	char tl[TASK_ROWS][MSG_BUFFER_SIZE]; // Task list
+	int tls; // Selected task
+
 	char prch[16]; // TODO adjust size
 	char* prompt;
 	int prompt_cursor_pos;
 
-	int timeout; // microseconds
-
-	struct append_buffer B[BUF_NUM];
+	int timeout; // microseconds; -1 = wait for input, 0 = busy
+
+	struct grid G;
+	struct append_buffer out; // Frame sent to the terminal
+	struct output_stats os;
+	bool sync; // Wrap frames in synchronized output
+	bool nocache; // Copy/move tasks get TF_NOCACHE
+	bool journal; // Copy/move tasks get TF_JOURNAL
+	bool uring; // Copy tasks may use CM_URING
+	bool cursor; // Is cursor visible
+	fnum_t ptop[2]; // First entry drawn in each panel
+	struct file** pfl[2]; // ...and file list it was in
+	struct row_key* rk[2]; // What each row of panels shows
 	enum dirty_flag dirty;
 	struct termios T;
 
@@ -517,7 +678,9 @@ struct ui {
 
 	struct input2cmd* kmap;
 	size_t kml; // Key Mapping Length
-	struct input K[INPUT_LIST_LENGTH];
+	struct key_tnode* kt;
+	size_t kn; // Trie node reached by keys typed so far; 0 = none
+	enum command ahead; // Read ahead, but not processed yet
 
 	char* path; // path of chmodded file
 
@@ -533,15 +696,17 @@ struct ui {
 	char group[LOGIN_BUF_SIZE];
 };
 
-typedef void (*draw_t)(struct ui* const, struct append_buffer* const);
-void ui_pathbar(struct ui* const, struct append_buffer* const);
-void ui_panels(struct ui* const, struct append_buffer* const);
-void ui_statusbar(struct ui* const, struct append_buffer* const);
-void ui_bottombar(struct ui* const, struct append_buffer* const);
+typedef void (*draw_t)(struct ui* const, struct grid* const);
+void ui_pathbar(struct ui* const, struct grid* const);
+void ui_panels(struct ui* const, struct grid* const);
+void ui_tasks(struct ui* const, struct grid* const);
+void ui_statusbar(struct ui* const, struct grid* const);
+void ui_bottombar(struct ui* const, struct grid* const);
 
 static const draw_t do_draw[] = {
 	[BUF_PATHBAR] = ui_pathbar,
 	[BUF_PANELS] = ui_panels,
+	[BUF_TASKS] = ui_tasks,
 	[BUF_STATUSBAR] = ui_statusbar,
 	[BUF_BOTTOMBAR] = ui_bottombar,
 };
@@ -552,6 +717,7 @@ void ui_init(struct ui* const, struct panel* const,
 void ui_end(struct ui* const);
 int help_to_fd(struct ui* const, const int);
 void ui_draw(struct ui* const);
+void ui_invalidate(struct ui* const);
 void ui_update_geometry(struct ui* const);
 
 int chmod_open(struct ui* const, char* const);
@@ -565,7 +731,9 @@ struct select_option {
 int ui_ask(struct ui* const, const char* const q,
 		const struct select_option*, const size_t);
 
+int keymap_compile(struct ui* const);
 enum command get_cmd(struct ui* const);
+int keymap_add(struct ui* const, const char*);
 int fill_textbox(struct ui* const, char* const,
 		char** const, const size_t, struct input* const);
 
@@ -581,6 +749,6 @@ enum spawn_flags {
 
 int spawn(char* const[], const enum spawn_flags);
 
-size_t append_theme(struct append_buffer* const, const enum theme_element);
+void grid_theme(struct grid* const, const enum theme_element);
 
 #endif
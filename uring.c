@@ -0,0 +1,252 @@
+/*
+ *  Copyright (C) 2017-2018 by Michał Czarnecki <czarnecky@va.pl>
+ *
+ *  This file is part of the Hund.
+ *
+ *  The Hund is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Hund is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "uring.h"
+
+#if HAS_URING
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+static const unsigned char needed_ops[] = {
+	IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE,
+};
+
+static bool _probe(const int fd) {
+	const size_t len = sizeof(struct io_uring_probe)
+		+ 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe* const p = calloc(1, len);
+	if (!p) return false;
+	bool ok = !syscall(SYS_io_uring_register, fd,
+			IORING_REGISTER_PROBE, p, 256);
+	for (size_t o = 0; ok && o < sizeof(needed_ops); ++o) {
+		ok = needed_ops[o] <= p->last_op
+			&& (p->ops[needed_ops[o]].flags & IO_URING_OP_SUPPORTED);
+	}
+	free(p);
+	return ok;
+}
+
+static void* _map(const int fd, const size_t len, const off_t off) {
+	return mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, off);
+}
+
+int uring_init(struct uring* const u, const unsigned entries) {
+	memset(u, 0, sizeof(struct uring));
+	u->sq = u->cq = u->sqes = MAP_FAILED;
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(struct io_uring_params));
+	u->fd = syscall(SYS_io_uring_setup, entries, &p);
+	if (u->fd == -1) return errno;
+	fcntl(u->fd, F_SETFD, FD_CLOEXEC);
+	u->entries = p.sq_entries;
+	u->sql = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cql = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	u->sqesl = p.sq_entries * sizeof(struct io_uring_sqe);
+	const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+	if (single) {
+		if (u->cql > u->sql) u->sql = u->cql;
+		u->cql = u->sql;
+	}
+	int e = 0;
+	if ((u->sq = _map(u->fd, u->sql, IORING_OFF_SQ_RING)) == MAP_FAILED
+	|| (u->cq = (single ? u->sq
+		: _map(u->fd, u->cql, IORING_OFF_CQ_RING))) == MAP_FAILED
+	|| (u->sqes = _map(u->fd, u->sqesl, IORING_OFF_SQES)) == MAP_FAILED) {
+		e = errno;
+	}
+	else if (!_probe(u->fd)) {
+		e = ENOSYS;
+	}
+	if (e) {
+		uring_end(u);
+		return e;
+	}
+	char* const sq = u->sq;
+	char* const cq = u->cq;
+	u->sqh = (unsigned*)(sq + p.sq_off.head);
+	u->sqt = (unsigned*)(sq + p.sq_off.tail);
+	u->sqm = (unsigned*)(sq + p.sq_off.ring_mask);
+	u->sqa = (unsigned*)(sq + p.sq_off.array);
+	u->cqh = (unsigned*)(cq + p.cq_off.head);
+	u->cqt = (unsigned*)(cq + p.cq_off.tail);
+	u->cqm = (unsigned*)(cq + p.cq_off.ring_mask);
+	u->cqes = cq + p.cq_off.cqes;
+	return 0;
+}
+
+void uring_end(struct uring* const u) {
+	if (u->sqes != MAP_FAILED) munmap(u->sqes, u->sqesl);
+	if (u->cq != MAP_FAILED && u->cq != u->sq) munmap(u->cq, u->cql);
+	if (u->sq != MAP_FAILED) munmap(u->sq, u->sql);
+	if (u->fd != -1) close(u->fd);
+	memset(u, 0, sizeof(struct uring));
+	u->fd = -1;
+	u->sq = u->cq = u->sqes = MAP_FAILED;
+}
+
+/*
+ * Next free submission queue entry; NULL if queue is full
+ * Kernel sees it after uring_submit()
+ */
+static struct io_uring_sqe* _sqe(struct uring* const u) {
+	const unsigned tail = *u->sqt + u->pending;
+	if (tail - __atomic_load_n(u->sqh, __ATOMIC_ACQUIRE) >= u->entries) {
+		return NULL;
+	}
+	const unsigned i = tail & *u->sqm;
+	struct io_uring_sqe* const s = (struct io_uring_sqe*)u->sqes + i;
+	memset(s, 0, sizeof(struct io_uring_sqe));
+	u->sqa[i] = i;
+	u->pending += 1;
+	return s;
+}
+
+int uring_openat(struct uring* const u, const char* const path,
+		const int flags, const mode_t mode, const uint64_t data) {
+	struct io_uring_sqe* const s = _sqe(u);
+	if (!s) return EBUSY;
+	s->opcode = IORING_OP_OPENAT;
+	s->fd = AT_FDCWD;
+	s->addr = (uintptr_t)path;
+	s->len = mode;
+	s->open_flags = flags | O_CLOEXEC;
+	s->user_data = data;
+	return 0;
+}
+
+int uring_read(struct uring* const u, const int fd, void* const buf,
+		const unsigned len, const uint64_t data) {
+	struct io_uring_sqe* const s = _sqe(u);
+	if (!s) return EBUSY;
+	s->opcode = IORING_OP_READ;
+	s->fd = fd;
+	s->addr = (uintptr_t)buf;
+	s->len = len;
+	s->off = 0;
+	s->user_data = data;
+	return 0;
+}
+
+int uring_close(struct uring* const u, const int fd, const uint64_t data) {
+	struct io_uring_sqe* const s = _sqe(u);
+	if (!s) return EBUSY;
+	s->opcode = IORING_OP_CLOSE;
+	s->fd = fd;
+	s->user_data = data;
+	return 0;
+}
+
+/*
+ * Submits everything prepared and waits until all of it completes
+ * *n = number of operations that kernel took (and that completed)
+ */
+int uring_submit(struct uring* const u, unsigned* const n) {
+	*n = 0;
+	__atomic_store_n(u->sqt, *u->sqt + u->pending, __ATOMIC_RELEASE);
+	u->pending = 0;
+	for (;;) {
+		const unsigned left = *u->sqt - __atomic_load_n(u->sqh,
+				__ATOMIC_ACQUIRE);
+		if (!left) return 0;
+		const long r = syscall(SYS_io_uring_enter, u->fd,
+				left, left, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (r == -1 && errno != EINTR) return errno;
+		if (r > 0) *n += r;
+		else if (!r) return EBUSY;
+	}
+}
+
+/*
+ * Takes one result; waits if there is none yet
+ */
+int uring_wait(struct uring* const u, uint64_t* const data, int* const res) {
+	const unsigned head = *u->cqh;
+	while (head == __atomic_load_n(u->cqt, __ATOMIC_ACQUIRE)) {
+		if (syscall(SYS_io_uring_enter, u->fd, 0, 1,
+				IORING_ENTER_GETEVENTS, NULL, 0) == -1
+		&& errno != EINTR) {
+			return errno;
+		}
+	}
+	const struct io_uring_cqe* const c =
+		(struct io_uring_cqe*)u->cqes + (head & *u->cqm);
+	*data = c->user_data;
+	*res = c->res;
+	__atomic_store_n(u->cqh, head + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+#else
+
+int uring_init(struct uring* const u, const unsigned entries) {
+	(void)(entries);
+	memset(u, 0, sizeof(struct uring));
+	u->fd = -1;
+	return ENOSYS;
+}
+
+void uring_end(struct uring* const u) {
+	(void)(u);
+}
+
+int uring_openat(struct uring* const u, const char* const path,
+		const int flags, const mode_t mode, const uint64_t data) {
+	(void)(u);
+	(void)(path);
+	(void)(flags);
+	(void)(mode);
+	(void)(data);
+	return ENOSYS;
+}
+
+int uring_read(struct uring* const u, const int fd, void* const buf,
+		const unsigned len, const uint64_t data) {
+	(void)(u);
+	(void)(fd);
+	(void)(buf);
+	(void)(len);
+	(void)(data);
+	return ENOSYS;
+}
+
+int uring_close(struct uring* const u, const int fd, const uint64_t data) {
+	(void)(u);
+	(void)(fd);
+	(void)(data);
+	return ENOSYS;
+}
+
+int uring_submit(struct uring* const u, unsigned* const n) {
+	(void)(u);
+	*n = 0;
+	return ENOSYS;
+}
+
+int uring_wait(struct uring* const u, uint64_t* const data, int* const res) {
+	(void)(u);
+	(void)(data);
+	(void)(res);
+	return ENOSYS;
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (C) 2017-2018 by Michał Czarnecki <czarnecky@va.pl>
+ *
+ *  This file is part of the Hund.
+ *
+ *  The Hund is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  The Hund is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#ifndef _DEFAULT_SOURCE
+	#define _DEFAULT_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#define HAS_URING 1
+	#endif
+#endif
+#ifndef HAS_URING
+	#define HAS_URING 0
+#endif
+
+/*
+ * Minimal io_uring, through raw syscalls
+ *
+ * Operations are prepared with uring_openat() etc.,
+ * sent to the kernel with uring_submit() and their results
+ * are collected with uring_wait(). Each operation carries
+ * data that comes back with its result.
+ *
+ * uring_init() fails with ENOSYS if kernel (or build)
+ * can't do io_uring or any of the operations used here.
+ */
+
+struct uring {
+	int fd;
+	unsigned entries;
+	unsigned pending; // Prepared, not submitted
+	unsigned *sqh, *sqt, *sqm, *sqa; // Submission queue head, tail, mask, array
+	unsigned *cqh, *cqt, *cqm; // Completion queue head, tail, mask
+	void* sqes;
+	void* cqes;
+	void* sq;
+	void* cq;
+	size_t sql, cql, sqesl; // Lengths of mappings
+};
+
+int uring_init(struct uring* const, const unsigned);
+void uring_end(struct uring* const);
+
+int uring_openat(struct uring* const, const char* const,
+		const int, const mode_t, const uint64_t);
+int uring_read(struct uring* const, const int, void* const,
+		const unsigned, const uint64_t);
+int uring_close(struct uring* const, const int, const uint64_t);
+
+int uring_submit(struct uring* const, unsigned* const);
+int uring_wait(struct uring* const, uint64_t* const, int* const);
+
+#endif
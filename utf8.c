@@ -19,6 +19,10 @@
 
 #include "utf8.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /* CodePoint To Bytes */
 void utf8_cp2b(char* const b, codepoint_t cp) {
 #if 1
@@ -139,33 +143,119 @@ size_t utf8_cp2nb(const codepoint_t cp) {
 
 /* Glyph to width */
 size_t utf8_g2w(const codepoint_t cp) {
-	if (cp < 0x20) return 0;
-	if (cp < 0x7f) return 1;
-	if (cp_in(zero_width, zero_width_len-1, cp)) return 0;
-	if (cp_in(double_width, double_width_len-1, cp)) return 2;
-	return 1;
+	if (cp < 0x7f) return cp >= 0x20;
+	if (cp > 0x10ffff) return 1;
+	const unsigned char* const b = width_stage2[width_stage1[cp >> 8]];
+	return (b[(cp & 0xff) >> 2] >> ((cp & 3) << 1)) & 3;
+}
+
+/*
+ * Length of the leading span of printable ASCII (0x20-0x7f) in a[0..n)
+ * Every such byte is a glyph 1 column wide
+ */
+static size_t _ascii_span(const char* const a, const size_t n) {
+	size_t i = 0;
+	if (!n || (unsigned char)a[0] < 0x20 || (unsigned char)a[0] >= 0x80) {
+		return 0;
+	}
+#if defined(__SSE2__)
+	/* Printable ASCII bytes are exactly those > 0x1f as signed chars */
+	const __m128i sp = _mm_set1_epi8(0x1f);
+	while (n - i >= 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i*)(a+i));
+		unsigned m = _mm_movemask_epi8(_mm_cmpgt_epi8(v, sp));
+		if (m != 0xffff) {
+			while (m & 1) {
+				m >>= 1;
+				i += 1;
+			}
+			return i;
+		}
+		i += 16;
+	}
+#endif
+	const uint64_t H = UINT64_C(0x8080808080808080);
+	const uint64_t L = UINT64_C(0x2020202020202020);
+	while (n - i >= 8) {
+		uint64_t v;
+		memcpy(&v, a+i, sizeof(v));
+		/* Some byte has top bit set or is below 0x20 */
+		if ((v & H) || ((v - L) & ~v & H)) break;
+		i += 8;
+	}
+	while (i < n && (unsigned char)a[i] >= 0x20
+	&& (unsigned char)a[i] < 0x80) {
+		i += 1;
+	}
+	return i;
+}
+
+/*
+ * Length of a valid glyph at a, not longer than n
+ * 0 if invalid or truncated
+ */
+static size_t _valid_glyph(const char* const a, const size_t n) {
+	const size_t s = utf8_g2nb(a);
+	if (!s || s > n) return 0;
+	for (size_t i = 1; i < s; ++i) {
+		if ((a[i] & 0xc0) != 0x80) return 0;
+	}
+	return s;
+}
+
+/*
+ * Width of glyphs from a to e
+ * Stops at invalid or truncated glyph
+ */
+static size_t _width(const char* a, const char* const e) {
+	size_t w = 0;
+	while (a < e) {
+		const size_t n = _ascii_span(a, e-a);
+		if (n) {
+			w += n;
+			a += n;
+			continue;
+		}
+		const size_t s = utf8_g2nb(a);
+		if (!s || s > (size_t)(e - a)) break;
+		w += utf8_g2w(utf8_b2cp(a));
+		a += s;
+	}
+	return w;
 }
 
 /* Apparent width */
 size_t utf8_width(const char* b) {
-	size_t g = 0;
-	size_t s;
-	while (*b && (s = utf8_g2nb(b)) != 0) {
-		g += utf8_g2w(utf8_b2cp(b));
-		b += s;
-	}
-	return g;
+	return _width(b, b+strlen(b));
 }
 
 /*
  * Width To Number of Bytes
  * Calculates how much bytes will fill given width
+ * Glyph that would exceed w is not included
  */
 size_t utf8_w2nb(const char* const b, size_t w) {
+	const char* const e = b+strlen(b);
 	size_t r = 0;
-	while (*(b+r) && w > 0) {
-		r += utf8_g2nb(b+r);
-		w -= utf8_g2w(utf8_b2cp(b+r));
+	while (b+r < e && w > 0) {
+		size_t n = _ascii_span(b+r, e-(b+r));
+		if (n) {
+			if (n > w) n = w;
+			r += n;
+			w -= n;
+			continue;
+		}
+		const size_t s = utf8_g2nb(b+r);
+		if (!s || s > (size_t)(e - (b+r))) {
+			/* Invalid byte; drawn as '?' */
+			r += 1;
+			w -= 1;
+			continue;
+		}
+		const size_t gw = utf8_g2w(utf8_b2cp(b+r));
+		if (gw > w) break;
+		r += s;
+		w -= gw;
 	}
 	return r;
 }
@@ -174,33 +264,39 @@ size_t utf8_w2nb(const char* const b, size_t w) {
  * Width till some address in that string
  */
 size_t utf8_wtill(const char* a, const char* const b) {
-	size_t w = 0;
-	while (b - a > 0) {
-		w += utf8_g2w(utf8_b2cp(a));
-		a += utf8_g2nb(a);
-	}
-	return w;
+	return _width(a, b);
 }
 
 bool utf8_validate(const char* const b) {
 	const size_t bl = strlen(b);
 	size_t i = 0;
 	while (i < bl) {
-		const size_t s = utf8_g2nb(b+i);
-		if (!s) break;
-		/* Now check if bytes following the
-		 * inital byte are like 10xxxxxx
-		 */
-		if (s > 1) {
-			const char* v = b+i+1;
-			while (v < b+i+s) {
-				if ((*v & 0xc0) != 0x80) return false;
-				v += 1;
-			}
-		}
+		i += _ascii_span(b+i, bl-i);
+		if (i == bl) break;
+		/* Bytes following the inital byte must be like 10xxxxxx */
+		const size_t s = _valid_glyph(b+i, bl-i);
+		if (!s) return false;
+		i += s;
+	}
+	return true;
+}
+
+/*
+ * Tells what needs to be done with a string before it is drawn
+ */
+enum utf8_class utf8_classify(const char* const b, const size_t n) {
+	enum utf8_class c = UTF8_ASCII;
+	size_t i = 0;
+	while (i < n) {
+		i += _ascii_span(b+i, n-i);
+		if (i == n) break;
+		/* Single byte here is a control character */
+		const size_t s = _valid_glyph(b+i, n-i);
+		if (s <= 1) return UTF8_UNWANTED;
+		c = UTF8_CLEAN;
 		i += s;
 	}
-	return i == bl;
+	return c;
 }
 
 void utf8_insert(char* a, const char* const b, const size_t pos) {
@@ -228,12 +324,23 @@ size_t utf8_remove(char* const a, const size_t j) {
 
 /*
  * Copies only valid utf8 characters and non-control ascii to buf
+ * Other bytes are replaced with c
+ * n = maximum number of glyphs
  */
 unsigned cut_unwanted(const char* str, char* buf, const char c, size_t n) {
 	unsigned u = 0;
-	while (*str && n) {
-		const size_t nb = utf8_g2nb(str);
-		if (!nb || (nb == 1 && *str < ' ')) {
+	const size_t l = strlen(str);
+	const char* const e = str+l;
+	while (str < e && n) {
+		size_t a = _ascii_span(str, e-str);
+		if (a > n) a = n;
+		memcpy(buf, str, a);
+		buf += a;
+		str += a;
+		n -= a;
+		if (str == e || !n) break;
+		const size_t nb = _valid_glyph(str, e-str);
+		if (nb <= 1) {
 			*buf = c;
 			buf += 1;
 			str += 1;
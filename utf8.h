@@ -22,6 +22,7 @@
 
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "widechars.h"
 
@@ -37,6 +38,14 @@ size_t utf8_w2nb(const char* const, size_t);
 size_t utf8_wtill(const char*, const char* const);
 bool utf8_validate(const char* const);
 
+enum utf8_class {
+	UTF8_ASCII = 0, // Printable ASCII only
+	UTF8_CLEAN, // Valid UTF-8 without control characters
+	UTF8_UNWANTED, // Needs cut_unwanted()
+};
+
+enum utf8_class utf8_classify(const char* const, const size_t);
+
 void utf8_insert(char*, const char* const, const size_t);
 size_t utf8_remove(char* const, const size_t);
 